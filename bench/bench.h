@@ -0,0 +1,110 @@
+#ifndef UTILS_BENCH_H
+#define UTILS_BENCH_H
+
+#include "../include/utils.h"
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+LIBUTILS_NAMESPACE_BEGIN
+namespace bench {
+
+/** Prevent the compiler from optimising away a value */
+template <typename T>
+[[gnu::always_inline]] inline void DoNotOptimize(T&& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/** Prevent the compiler from caching values in registers across this point */
+[[gnu::always_inline]] inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+/** How benchmarks are run */
+struct Config {
+    U64 repetitions     = 15;   /// Number of samples per benchmark
+    F64 min_sample_time = 0.02; /// Minimum duration of a sample, in seconds
+    F64 warmup_time     = 0.05; /// How long to run a benchmark before measuring it, in seconds
+};
+
+/** The result of a single benchmark */
+struct Result {
+    std::string name;
+    U64         iterations{}; /// Iterations per sample
+    U64         bytes{};      /// Bytes processed per iteration, if any
+    F64         median_ns{};  /// Median time per iteration
+    F64         p10_ns{};     /// 10th percentile of the time per iteration
+    F64         p90_ns{};     /// 90th percentile of the time per iteration
+    F64         min_ns{};     /// Fastest sample
+
+    /** Throughput in bytes per second, or 0 if the benchmark doesn't process bytes */
+    [[nodiscard]] F64 BytesPerSecond() const { return bytes ? F64(bytes) * 1e9 / median_ns : 0; }
+};
+
+/**
+ * Passed to every benchmark to run measurements
+ * <p>
+ * A benchmark may call Run() multiple times to measure
+ * several variants; each call produces a separate result.
+ */
+class Context {
+    const Config&        config;
+    std::string          prefix;
+    std::vector<Result>& results;
+
+    /** Calibrate, warm up, and sample a function that runs a given number of iterations */
+    void Measure(const std::string& name, U64 bytes, const std::function<F64(U64)>& run);
+
+public:
+    Context(const Config& _config, std::string _prefix, std::vector<Result>& _results)
+        : config(_config), prefix(std::move(_prefix)), results(_results) {}
+
+    /**
+     * Measure a function
+     * @param name The name of this measurement; it is appended to the name of the benchmark
+     * @param bytes The number of bytes that `fn' processes per call, or 0
+     * @param fn The function to measure
+     */
+    template <typename Callable>
+    void Run(const std::string& name, U64 bytes, Callable&& fn) {
+        /// Keep the loop in here so that `fn' can be inlined into it.
+        Measure(name, bytes, [&](U64 iterations) -> F64 {
+            const auto start = std::chrono::steady_clock::now();
+            for (U64 i = 0; i < iterations; i++) {
+                fn();
+                ClobberMemory();
+            }
+            const auto end = std::chrono::steady_clock::now();
+            return F64(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        });
+    }
+};
+
+/** A benchmark; use LIBUTILS_BENCHMARK to define one */
+struct Benchmark {
+    std::string                   name;
+    std::function<void(Context&)> fn;
+};
+
+/** All benchmarks that have been registered */
+std::vector<Benchmark>& Registry();
+
+/** Registers a benchmark at startup */
+struct Registration {
+    Registration(std::string name, std::function<void(Context&)> fn) {
+        Registry().push_back({std::move(name), std::move(fn)});
+    }
+};
+
+} // namespace bench
+LIBUTILS_NAMESPACE_END
+
+/** Define a benchmark; the body has access to a `bench::Context& ctx' */
+#define LIBUTILS_BENCHMARK(name)                                                                \
+    static void                      _libutils_bench_##name(bench::Context& ctx);                \
+    static const bench::Registration _libutils_bench_reg_##name{#name, _libutils_bench_##name}; \
+    static void                      _libutils_bench_##name(bench::Context& ctx)
+
+#endif // UTILS_BENCH_H
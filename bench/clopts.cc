@@ -0,0 +1,22 @@
+#include "../include/clopts.h"
+#include "./bench.h"
+
+LIBUTILS_BENCHMARK(CloptsParse) {
+    const char* args[] = {"prog", "--output", "out.txt", "--verbose", "--mode=fast", "--color", "true", "input.txt", "--", "rest", "of", "args"};
+    std::vector<char*> argv;
+    for (const char* arg : args) argv.push_back(const_cast<char*>(arg));
+
+    ctx.Run("", 0, [&] {
+        Clopts opts{
+            {"--output", "Output file"},
+            {"--verbose", "Print more", Clopts::Type::Void},
+            {"--mode", "Mode"},
+            {"--color", "Use colours", Clopts::Type::Bool},
+            {"--debug", "Enable debugging", Clopts::Type::Void},
+            {"--", "Arguments to pass on", Clopts::Type::Rest},
+            {"file", "Input file", Clopts::Type::String, true, true},
+        };
+        opts.Parse(int(argv.size()), argv.data());
+        bench::DoNotOptimize(opts["--output"].AsString());
+    });
+}
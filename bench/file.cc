@@ -0,0 +1,204 @@
+#include "../include/append-log.h"
+#include "../include/async.h"
+#include "../include/file.h"
+#include "./bench.h"
+
+#include <cstdlib>
+#include <random>
+
+namespace {
+/// A temporary file that is deleted when it goes out of scope.
+struct TempFile {
+    std::string path = "/tmp/utils_bench_XXXXXX";
+    U64         size{};
+
+    explicit TempFile(U64 _size) : size(_size) {
+        const int fd = mkstemp(path.data());
+        if (fd < 0) Die("mkstemp(): %s", std::strerror(errno));
+
+        /// Lines of varying length, like a log file.
+        std::mt19937 rng{42};
+        std::string  contents;
+        contents.reserve(size);
+        while (contents.size() < size) {
+            contents.append(rng() % 120, 'x');
+            contents += '\n';
+        }
+        contents.resize(size);
+        if (write(fd, contents.data(), contents.size()) != I64(contents.size())) Die("write(): %s", std::strerror(errno));
+        close(fd);
+    }
+
+    ~TempFile() { unlink(path.c_str()); }
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(TempFile);
+};
+} // namespace
+
+LIBUTILS_BENCHMARK(FileDrain) {
+    for (U64 size : {U64(64) << 10, U64(16) << 20}) {
+        TempFile tmp{size};
+        IFile    f{tmp.path};
+        ctx.Run(std::to_string(size >> 10) + "KiB", size, [&] {
+            lseek(f.fd, 0, SEEK_SET);
+            bench::DoNotOptimize(f.Drain());
+        });
+    }
+}
+
+LIBUTILS_BENCHMARK(FileLines) {
+    TempFile tmp{U64(16) << 20};
+    IFile    f{tmp.path};
+    ctx.Run("", tmp.size, [&] {
+        lseek(f.fd, 0, SEEK_SET);
+        U64 n = 0;
+        for (auto&& line : f.Lines()) n += line.size();
+        bench::DoNotOptimize(n);
+    });
+}
+
+LIBUTILS_BENCHMARK(FileLineViews) {
+    TempFile tmp{U64(16) << 20};
+    IFile    f{tmp.path};
+    ctx.Run("", tmp.size, [&] {
+        lseek(f.fd, 0, SEEK_SET);
+        U64 n = 0;
+        for (auto line : f.LineViews()) n += line.size();
+        bench::DoNotOptimize(n);
+    });
+}
+
+LIBUTILS_BENCHMARK(MappedFile) {
+    TempFile tmp{U64(16) << 20};
+    ctx.Run("lines", tmp.size, [&] {
+        MappedFile f{tmp.path, {.advice = MapAdvice::Sequential}};
+        U64        n = 0;
+        for (auto text = f.View(); !text.empty(); n++) {
+            const U64 nl = text.find('\n');
+            if (nl == std::string_view::npos) break;
+            text.remove_prefix(nl + 1);
+        }
+        bench::DoNotOptimize(n);
+    });
+}
+
+LIBUTILS_BENCHMARK(BufferedWriter) {
+    OFile devnull{"/dev/null"};
+    U64   bytes = 0;
+    for (U64 i = 0; i < 100'000; i++) bytes += 6 + std::to_string(i % 1000).size();
+    ctx.Run("fragments", bytes, [&] {
+        BufferedWriter w{devnull};
+        for (U64 i = 0; i < 100'000; i++) w << "key=" << i % 1000 << ", ";
+    });
+}
+
+LIBUTILS_BENCHMARK(AsyncRead) {
+    static constexpr U64   ChunkSize = U64(64) << 10;
+    TempFile               tmp{U64(16) << 20};
+    IFile                  f{tmp.path};
+    std::vector<std::byte> buffer(tmp.size);
+
+    ctx.Run("pread", tmp.size, [&] {
+        for (U64 off = 0; off < tmp.size; off += ChunkSize)
+            bench::DoNotOptimize(pread(f.fd, buffer.data() + off, ChunkSize, off_t(off)));
+    });
+
+    auto ReadChunk = [&](IOEngine& engine, U64 off) -> co_task<> {
+        bench::DoNotOptimize(co_await engine.AsyncRead(f.fd, std::span{buffer}.subspan(off, ChunkSize), off));
+    };
+
+    for (bool use_io_uring : {true, false}) {
+        IOEngine engine{256, use_io_uring};
+        if (use_io_uring && engine.GetBackend() != IOEngine::Backend::IOUring) continue;
+        ctx.Run(use_io_uring ? "io_uring" : "threads", tmp.size, [&] {
+            for (U64 off = 0; off < tmp.size; off += ChunkSize) engine.Spawn(ReadChunk(engine, off));
+            engine.Run();
+        });
+    }
+}
+
+LIBUTILS_BENCHMARK(FileCopy) {
+    TempFile tmp{U64(64) << 20};
+    TempFile dest{0};
+    IFile    in{tmp.path};
+    OFile    out{dest.path};
+    const auto Rewind = [&] {
+        lseek(in.fd, 0, SEEK_SET);
+        lseek(out.fd, 0, SEEK_SET);
+    };
+
+    std::vector<std::byte> buffer(128 * 1024);
+    ctx.Run("read-write", tmp.size, [&] {
+        Rewind();
+        while (const U64 n = in.ReadInto(buffer)) out.Write({reinterpret_cast<const char*>(buffer.data()), n});
+    });
+    ctx.Run("CopyTo", tmp.size, [&] {
+        Rewind();
+        bench::DoNotOptimize(in.CopyTo(out));
+    });
+    ctx.Run("SpliceTo", tmp.size, [&] {
+        Rewind();
+        bench::DoNotOptimize(in.SpliceTo(out));
+    });
+}
+
+LIBUTILS_BENCHMARK(FileRandomRead) {
+    static constexpr U64   BlockSize = 4096;
+    static constexpr U64   Reads     = 1024;
+    TempFile               tmp{U64(16) << 20};
+    IFile                  f{tmp.path};
+    std::vector<std::byte> buffer(BlockSize);
+    std::vector<U64>       offsets;
+    std::mt19937_64        rng{42};
+    for (U64 i = 0; i < Reads; i++) offsets.push_back(rng() % (tmp.size - BlockSize));
+
+    ctx.Run("lseek-read", Reads * BlockSize, [&] {
+        for (U64 off : offsets) {
+            lseek(f.fd, off_t(off), SEEK_SET);
+            bench::DoNotOptimize(f.ReadInto(buffer));
+        }
+    });
+    ctx.Run("PRead", Reads * BlockSize, [&] {
+        for (U64 off : offsets) bench::DoNotOptimize(f.PRead(buffer, off));
+    });
+}
+
+LIBUTILS_BENCHMARK(ParallelLines) {
+    TempFile tmp{U64(64) << 20};
+    ctx.Run("", tmp.size, [&] {
+        const U64 n = ParallelLines<U64>(
+            tmp.path,
+            [](U64& total, std::string_view line) { total += line.size(); },
+            [](U64& total, U64&& other) { total += other; }
+        );
+        bench::DoNotOptimize(n);
+    });
+}
+
+LIBUTILS_BENCHMARK(AppendLog) {
+    constexpr U64              Threads = 4;
+    constexpr U64              Records = 100'000;
+    constexpr std::string_view Record  = "2024-01-01T00:00:00Z INFO request served in 1.234 ms\n";
+    OFile                      devnull{"/dev/null"};
+
+    ctx.Run("mutex+write", Threads * Records * Record.size(), [&] {
+        std::mutex               mutex;
+        std::vector<std::thread> threads;
+        for (U64 t = 0; t < Threads; t++) threads.emplace_back([&] {
+            for (U64 i = 0; i < Records; i++) {
+                std::unique_lock lock{mutex};
+                devnull.Write(Record);
+            }
+        });
+        for (auto& t : threads) t.join();
+    });
+
+    ctx.Run("ring+writev", Threads * Records * Record.size(), [&] {
+        AppendLog                log{devnull.fd};
+        std::vector<std::thread> threads;
+        for (U64 t = 0; t < Threads; t++) threads.emplace_back([&] {
+            for (U64 i = 0; i < Records; i++) log.Append(Record);
+        });
+        for (auto& t : threads) t.join();
+        log.Flush();
+    });
+}
@@ -0,0 +1,98 @@
+#include "../include/parser.h"
+#include "./bench.h"
+
+#include <random>
+
+namespace {
+using SourceFile     = FileBase<>;
+using SourceLocation = SourceLocationBase<SourceFile>;
+
+struct Token : TokenBase<Char, TokenTypeBase, SourceLocation> {
+    [[nodiscard]] String Str() const override { return string_content; }
+};
+
+/// A lexer for a small C-like language that exercises the helpers in LexerBase.
+struct Lexer : LexerBase<SourceFile, Token, SourceLocation> {
+    explicit Lexer(const std::string& filename, Interner<Char>* _interner = nullptr) : LexerBase(filename) {
+        interner = _interner;
+        NextToken();
+    }
+
+    void NextToken() override {
+        SkipWhitespace();
+        token.loc    = Here();
+        token.symbol = NoSymbol;
+        if (at_eof) {
+            token.type = T::EndOfFile;
+            return;
+        }
+
+        if (isstart(int(lastc)) || lastc == U'_') return LexIdentifier();
+
+        if (lastc >= U'0' && lastc <= U'9') {
+            token.type = T::Number;
+            LexNumber();
+            return;
+        }
+
+        if (lastc == U'"') {
+            token.type = T::String;
+            token.string_content.clear();
+            LexStringLiteral();
+            return;
+        }
+
+        token.type = static_cast<T>(lastc);
+        NextChar();
+    }
+};
+
+/// Write a source file of roughly `size' bytes and return its path.
+std::string MakeSource(U64 size) {
+    static constexpr std::string_view idents[] = {"foo", "bar", "baz", "count", "index", "value", "result", "_tmp",
+        "parse_expression", "next_token", "größe", "x", "y", "i"};
+
+    std::mt19937 rng{42};
+    std::string  src;
+    while (src.size() < size) {
+        src += idents[rng() % std::size(idents)];
+        switch (rng() % 6) {
+            case 0: src += " = " + std::to_string(rng() % 100000) + ";\n"; break;
+            case 1: src += " = 0x" + std::to_string(rng() % 10000) + ";\n"; break;
+            case 2: src += "(\"some string\\n\", " + std::string{idents[rng() % std::size(idents)]} + ");\n"; break;
+            case 3: src += " {\n"; break;
+            case 4: src += " }\n"; break;
+            default: src += ", "; break;
+        }
+    }
+
+    std::string path = "/tmp/utils_bench_lexer_XXXXXX";
+    const int   fd   = mkstemp(path.data());
+    if (fd < 0) Die("mkstemp(): %s", std::strerror(errno));
+    if (write(fd, src.data(), src.size()) != I64(src.size())) Die("write(): %s", std::strerror(errno));
+    close(fd);
+    return path;
+}
+} // namespace
+
+LIBUTILS_BENCHMARK(Lexer) {
+    const auto path = MakeSource(U64(1) << 20);
+    const auto size = U64(std::filesystem::file_size(path));
+
+    ctx.Run("plain", size, [&] {
+        Lexer lexer{path};
+        U64   n = 0;
+        for (; lexer.token.type != TokenTypeBase::EndOfFile; lexer.NextToken()) n++;
+        bench::DoNotOptimize(n);
+    });
+
+    Interner<Char> interner;
+    ctx.Run("interned", size, [&] {
+        Lexer lexer{path, &interner};
+        U64   n = 0;
+        for (; lexer.token.type != TokenTypeBase::EndOfFile; lexer.NextToken()) n++;
+        bench::DoNotOptimize(n);
+    });
+
+    unlink(path.c_str());
+}
@@ -0,0 +1,205 @@
+#include "../include/clopts.h"
+#include "./bench.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+LIBUTILS_NAMESPACE_BEGIN
+namespace bench {
+
+std::vector<Benchmark>& Registry() {
+    static std::vector<Benchmark> registry;
+    return registry;
+}
+
+namespace {
+/// Linearly interpolated percentile of a sorted vector.
+F64 Percentile(const std::vector<F64>& sorted, F64 p) {
+    const F64 pos  = p * F64(sorted.size() - 1);
+    const U64 lo   = U64(pos);
+    const U64 hi   = std::min(lo + 1, sorted.size() - 1);
+    const F64 frac = pos - F64(lo);
+    return sorted[lo] * (1 - frac) + sorted[hi] * frac;
+}
+
+std::string Format(const char* fmt, F64 value, const char* unit) {
+    char buf[64];
+    std::snprintf(buf, sizeof buf, fmt, value, unit);
+    return buf;
+}
+
+std::string FormatTime(F64 ns) {
+    if (ns < 1e3) return Format("%.2f %s", ns, "ns");
+    if (ns < 1e6) return Format("%.2f %s", ns / 1e3, "us");
+    if (ns < 1e9) return Format("%.2f %s", ns / 1e6, "ms");
+    return Format("%.2f %s", ns / 1e9, "s");
+}
+
+std::string FormatRate(F64 bytes_per_second) {
+    if (bytes_per_second == 0) return "";
+    if (bytes_per_second < 1e6) return Format("%.2f %s", bytes_per_second / 1e3, "kB/s");
+    if (bytes_per_second < 1e9) return Format("%.2f %s", bytes_per_second / 1e6, "MB/s");
+    return Format("%.2f %s", bytes_per_second / 1e9, "GB/s");
+}
+
+std::string JSONString(const std::string& str) {
+    std::string out = "\"";
+    for (char c : str) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+void WriteJSON(const std::string& path, const std::vector<Result>& results) {
+    std::ofstream out{path};
+    if (!out) Die("Could not open '%s' for writing", path.c_str());
+
+    /// One benchmark per line so that LoadBaseline() can parse it line by line.
+    out << "{\n  \"benchmarks\": [\n";
+    for (U64 i = 0; i < results.size(); i++) {
+        const auto& r = results[i];
+        char        buf[512];
+        std::snprintf(buf, sizeof buf,
+            R"(    {"name": %s, "iterations": %lu, "bytes": %lu, "median_ns": %.3f, "p10_ns": %.3f, "p90_ns": %.3f, "min_ns": %.3f, "bytes_per_second": %.1f})",
+            JSONString(r.name).c_str(), r.iterations, r.bytes, r.median_ns, r.p10_ns, r.p90_ns, r.min_ns, r.BytesPerSecond());
+        out << buf << (i + 1 == results.size() ? "\n" : ",\n");
+    }
+    out << "  ]\n}\n";
+}
+
+/// Read the median times from a file written by WriteJSON().
+std::unordered_map<std::string, F64> LoadBaseline(const std::string& path) {
+    std::ifstream in{path};
+    if (!in) Die("Could not open baseline '%s'", path.c_str());
+
+    std::unordered_map<std::string, F64> baseline;
+    std::string                          line;
+    while (std::getline(in, line)) {
+        static constexpr std::string_view name_key = R"("name": ")", median_key = R"("median_ns": )";
+        const U64                         name_pos = line.find(name_key), median_pos = line.find(median_key);
+        if (name_pos == std::string::npos || median_pos == std::string::npos) continue;
+
+        std::string name;
+        for (U64 i = name_pos + name_key.size(); i < line.size() && line[i] != '"'; i++) {
+            if (line[i] == '\\' && i + 1 < line.size()) i++;
+            name += line[i];
+        }
+        baseline[name] = std::strtod(line.c_str() + median_pos + median_key.size(), nullptr);
+    }
+    return baseline;
+}
+
+U64 ParseU64(const Clopts& opts, const std::string& name, U64 fallback) {
+    if (!opts[name].Found()) return fallback;
+    const auto& str = opts[name].AsString();
+    char*       end{};
+    const U64   val = std::strtoull(str.c_str(), &end, 10);
+    if (str.empty() || *end) Die("%s: expected a number, got '%s'", name.c_str(), str.c_str());
+    return val;
+}
+} // namespace
+
+void Context::Measure(const std::string& name, U64 bytes, const std::function<F64(U64)>& run) {
+    /// Find an iteration count that makes one sample take at least min_sample_time.
+    const F64 target     = config.min_sample_time * 1e9;
+    U64       iterations = 1;
+    for (;;) {
+        const F64 ns = run(iterations);
+        if (ns >= target) break;
+        const U64 guess = ns > 0 ? U64(F64(iterations) * target * 1.2 / ns) : iterations * 10;
+        iterations      = std::clamp(guess, iterations + 1, iterations * 10);
+    }
+
+    /// Warm up caches, branch predictors, and the CPU frequency.
+    const auto warmup_start = std::chrono::steady_clock::now();
+    while (std::chrono::duration<F64>(std::chrono::steady_clock::now() - warmup_start).count() < config.warmup_time)
+        run(iterations);
+
+    std::vector<F64> samples;
+    samples.reserve(config.repetitions);
+    for (U64 i = 0; i < config.repetitions; i++) samples.push_back(run(iterations) / F64(iterations));
+    std::sort(samples.begin(), samples.end());
+
+    Result& r    = results.emplace_back();
+    r.name       = name.empty() ? prefix : prefix + "/" + name;
+    r.iterations = iterations;
+    r.bytes      = bytes;
+    r.median_ns  = Percentile(samples, 0.5);
+    r.p10_ns     = Percentile(samples, 0.1);
+    r.p90_ns     = Percentile(samples, 0.9);
+    r.min_ns     = samples.front();
+}
+
+} // namespace bench
+LIBUTILS_NAMESPACE_END
+
+int main(int argc, char** argv) {
+    Clopts opts{
+        {"--filter", "Only run benchmarks whose name contains this string"},
+        {"--json", "Write the results to this file as JSON"},
+        {"--baseline", "Compare the results to a JSON file written by --json"},
+        {"--threshold", "Percentage by which a benchmark must be slower than the baseline to count as a regression (default: 5)"},
+        {"--repetitions", "Number of samples per benchmark (default: 15)"},
+        {"--min-time-ms", "Minimum duration of a sample in milliseconds (default: 20)"},
+        {"--fail-on-regression", "Exit with status 1 if any benchmark regressed", Clopts::Type::Void},
+        {"--list", "List all benchmarks and exit", Clopts::Type::Void},
+    };
+    opts.Parse(argc, argv);
+
+    auto& registry = bench::Registry();
+    std::sort(registry.begin(), registry.end(), [](auto& a, auto& b) { return a.name < b.name; });
+    if (opts["--list"].Found()) {
+        for (const auto& b : registry) std::printf("%s\n", b.name.c_str());
+        return 0;
+    }
+
+    bench::Config config;
+    config.repetitions     = std::max<U64>(1, bench::ParseU64(opts, "--repetitions", config.repetitions));
+    config.min_sample_time = F64(bench::ParseU64(opts, "--min-time-ms", U64(config.min_sample_time * 1e3))) / 1e3;
+    const F64 threshold    = F64(bench::ParseU64(opts, "--threshold", 5)) / 100;
+
+    std::unordered_map<std::string, F64> baseline;
+    if (opts["--baseline"].Found()) baseline = bench::LoadBaseline(opts["--baseline"].AsString());
+
+#ifndef __OPTIMIZE__
+    std::fprintf(stderr, "\033[33mWarning:\033[m utils_bench was built without optimisations\n");
+#endif
+
+    std::printf("%-40s %12s %12s %12s %14s %10s\n", "Benchmark", "Median", "P10", "P90", "Throughput", "Change");
+    std::vector<bench::Result> results;
+    bool                       regressed = false;
+    for (const auto& b : registry) {
+        if (opts["--filter"].Found() && b.name.find(opts["--filter"].AsString()) == std::string::npos) continue;
+
+        const U64      first = results.size();
+        bench::Context ctx{config, b.name, results};
+        b.fn(ctx);
+
+        for (U64 i = first; i < results.size(); i++) {
+            const auto& r = results[i];
+            std::string change;
+            if (auto it = baseline.find(r.name); it != baseline.end() && it->second > 0) {
+                const F64  delta = r.median_ns / it->second - 1;
+                const bool bad   = delta > threshold;
+                regressed |= bad;
+
+                /// Pad before colouring so that the escape codes don't break the alignment.
+                change = bench::Format("%+9.1f%s", delta * 100, "%");
+                if (bad) change = "\033[31m" + change + "\033[m";
+                else if (delta < -threshold) change = "\033[32m" + change + "\033[m";
+            }
+            std::printf("%-40s %12s %12s %12s %14s %10s\n", r.name.c_str(), bench::FormatTime(r.median_ns).c_str(),
+                bench::FormatTime(r.p10_ns).c_str(), bench::FormatTime(r.p90_ns).c_str(),
+                bench::FormatRate(r.BytesPerSecond()).c_str(), change.c_str());
+            std::fflush(stdout);
+        }
+    }
+
+    if (opts["--json"].Found()) bench::WriteJSON(opts["--json"].AsString(), results);
+    return regressed && opts["--fail-on-regression"].Found() ? 1 : 0;
+}
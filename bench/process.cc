@@ -0,0 +1,35 @@
+#include "../include/process.h"
+#include "./bench.h"
+
+LIBUTILS_BENCHMARK(Process) {
+    ctx.Run("spawn", 0, [&] { bench::DoNotOptimize(Process::Run({"true"}).status.code); });
+    ctx.Run("spawn-shell", 0, [&] { bench::DoNotOptimize(Process::RunShell("true").status.code); });
+
+    const U64 size = U64(64) << 20;
+    ctx.Run("output", size, [&] {
+        bench::DoNotOptimize(Process::Run({"head", "-c", std::to_string(size), "/dev/zero"}).out.size());
+    });
+
+    ctx.Run("output-mapped", size, [&] {
+        bench::DoNotOptimize(Process::RunMapped({"head", "-c", std::to_string(size), "/dev/zero"})->out.Size());
+    });
+
+    const std::string input(size, 'x');
+    ctx.Run("round-trip", size, [&] { bench::DoNotOptimize(Process::Run({"cat"}, input).out.size()); });
+}
+
+LIBUTILS_BENCHMARK(ProcessPool) {
+    /// Jobs that do some work of their own, so that there's something to parallelise.
+    const std::vector<std::vector<std::string>> commands(32, {"sh", "-c", "i=0; while [ $i -lt 2000 ]; do i=$((i+1)); done"});
+    ctx.Run("sequential", 0, [&] {
+        for (const auto& argv : commands) bench::DoNotOptimize(Process::Run(argv).status.code);
+    });
+    ctx.Run("parallel", 0, [&] { bench::DoNotOptimize(RunAll(commands).size()); });
+}
+
+LIBUTILS_BENCHMARK(Coprocess) {
+    ctx.Run("spawn-per-request", 0, [&] { bench::DoNotOptimize(Process::Run({"cat"}, "request\n").out.size()); });
+
+    Coprocess cat{{"cat"}};
+    ctx.Run("round-trip", 0, [&] { bench::DoNotOptimize(cat.Request("request")->size()); });
+}
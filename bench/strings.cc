@@ -0,0 +1,112 @@
+#include "../include/unicode-utils.h"
+#include "../include/utils.h"
+#include "./bench.h"
+
+#include <random>
+
+namespace {
+/// Deterministic text that looks roughly like source code or prose: mostly
+/// short ASCII words, with the occasional quote, tab, and newline.
+std::string MakeText(U64 size, bool unicode = false) {
+    static constexpr std::string_view ascii_words[] = {"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+        "return", "template", "typename", "const", "auto", "std::string", "foo", "bar", "x", "=", "+", "{", "}"};
+    static constexpr std::string_view unicode_words[] = {"straße", "naïve", "café", "日本語", "Ελληνικά", "кириллица", "🦀"};
+    static constexpr std::string_view separators[]    = {" ", " ", " ", " ", " ", "\n", "\t", "\"", "'"};
+
+    std::mt19937 rng{42};
+    std::string  text;
+    text.reserve(size + 32);
+    while (text.size() < size) {
+        if (unicode && rng() % 4 == 0) text += unicode_words[rng() % std::size(unicode_words)];
+        else text += ascii_words[rng() % std::size(ascii_words)];
+        text += separators[rng() % std::size(separators)];
+    }
+
+    /// Don't cut a UTF-8 sequence in half.
+    while (text.size() > size && (U8(text[size]) & 0xC0) == 0x80) size++;
+    text.resize(size);
+    return text;
+}
+
+/// Text in scripts that need two or three bytes per character in UTF-8.
+std::string MakeNonLatinText(U64 size) {
+    static constexpr std::string_view words[] = {"привет", "кириллица", "Ελληνικά", "γλώσσα", "日本語", "中文", "한국어", "עברית"};
+
+    std::mt19937 rng{42};
+    std::string  text;
+    while (text.size() < size) {
+        text += words[rng() % std::size(words)];
+        text += ' ';
+    }
+    return text;
+}
+
+constexpr U64 TextSize = 1 << 20;
+} // namespace
+
+LIBUTILS_BENCHMARK(Escape) {
+    const auto text = MakeText(TextSize);
+    ctx.Run("ascii", text.size(), [&] { bench::DoNotOptimize(Escape(text)); });
+
+    const auto text32 = ToUTF32(text);
+    ctx.Run("utf32", text.size(), [&] { bench::DoNotOptimize(Escape(text32)); });
+}
+
+LIBUTILS_BENCHMARK(Unescape) {
+    const auto text = Escape(MakeText(TextSize));
+    ctx.Run("", text.size(), [&] { bench::DoNotOptimize(Unescape(text)); });
+}
+
+LIBUTILS_BENCHMARK(ToUTF32) {
+    const auto ascii = MakeText(TextSize);
+    ctx.Run("ascii", ascii.size(), [&] { bench::DoNotOptimize(ToUTF32(ascii)); });
+
+    const auto mixed = MakeText(TextSize, true);
+    ctx.Run("mixed", mixed.size(), [&] { bench::DoNotOptimize(ToUTF32(mixed)); });
+
+    const auto non_latin = MakeNonLatinText(TextSize);
+    ctx.Run("non-latin", non_latin.size(), [&] { bench::DoNotOptimize(ToUTF32(non_latin)); });
+}
+
+LIBUTILS_BENCHMARK(ToUTF8) {
+    const auto ascii = ToUTF32(MakeText(TextSize));
+    ctx.Run("ascii", ascii.size() * sizeof(Char), [&] { bench::DoNotOptimize(ToUTF8(ascii)); });
+
+    const auto mixed = ToUTF32(MakeText(TextSize, true));
+    ctx.Run("mixed", mixed.size() * sizeof(Char), [&] { bench::DoNotOptimize(ToUTF8(mixed)); });
+
+    const auto non_latin = ToUTF32(MakeNonLatinText(TextSize));
+    ctx.Run("non-latin", non_latin.size() * sizeof(Char), [&] { bench::DoNotOptimize(ToUTF8(non_latin)); });
+}
+
+LIBUTILS_BENCHMARK(ValidateUTF8) {
+    const auto mixed = MakeText(TextSize, true);
+    ctx.Run("mixed", mixed.size(), [&] { bench::DoNotOptimize(ValidateUTF8(mixed)); });
+}
+
+LIBUTILS_BENCHMARK(ReplaceAll) {
+    const auto        text = MakeText(TextSize);
+    const std::string from = "template", to = "tmpl";
+    ctx.Run("short", text.size(), [&] { bench::DoNotOptimize(ReplaceAllCopy(text, from, to)); });
+
+    /// Longer than Searcher::ShortNeedle, so this uses Two-Way.
+    const std::string long_from = "template typename const auto std::string foo", long_to = "String";
+    ctx.Run("long", text.size(), [&] { bench::DoNotOptimize(ReplaceAllCopy(text, long_from, long_to)); });
+
+    const MultiReplacer<std::string> many{{{"the", "a"}, {"fox", "cat"}, {"dog", "hound"}, {"const", "constexpr"}}};
+    ctx.Run("multi", text.size(), [&] { bench::DoNotOptimize(many.Replace(text)); });
+}
+
+LIBUTILS_BENCHMARK(XID) {
+    const auto text = ToUTF32(MakeText(TextSize, true));
+    ctx.Run("isstart", text.size() * sizeof(Char), [&] {
+        U64 n = 0;
+        for (Char c : text) n += isstart(int(c));
+        bench::DoNotOptimize(n);
+    });
+    ctx.Run("iscontinue", text.size() * sizeof(Char), [&] {
+        U64 n = 0;
+        for (Char c : text) n += iscontinue(int(c));
+        bench::DoNotOptimize(n);
+    });
+}
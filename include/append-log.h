@@ -0,0 +1,133 @@
+#ifndef UTILS_APPEND_LOG_H
+#define UTILS_APPEND_LOG_H
+
+#include "./file.h"
+#include "./utils.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+LIBUTILS_NAMESPACE_BEGIN
+
+/** How an AppendLog behaves */
+struct AppendLogOptions {
+    /// The number of records that can be queued before Append() blocks;
+    /// rounded up to a power of two.
+    U64 capacity = 8192;
+
+    /// How often to fdatasync() the file if anything has been written
+    /// since the last time; 0 means only when Flush(true) is called.
+    std::chrono::milliseconds sync_interval{0};
+};
+
+/**
+ * A log file that many threads can append records to at once
+ * <p>
+ * Records are copied into a lock-free ring buffer by the threads that
+ * append them, and written to the file by a dedicated flusher thread,
+ * which writes as many records as are queued with a single writev(). If
+ * the ring buffer is full, Append() waits for the flusher to catch up;
+ * TryAppend() gives up instead.
+ * <p>
+ * Each record is written in one piece, and records from the same thread
+ * are written in the order in which they were appended. Records are
+ * written as-is, so they should usually end with a newline.
+ * <p>
+ * The error handler is called on the flusher thread.
+ */
+class AppendLog {
+    /// Records up to this size are stored in the ring buffer itself; larger
+    /// ones are copied to the heap.
+    static constexpr U64 SlotSize = 256;
+
+    /// A slot whose sequence number is equal to the position of a record
+    /// is free for that record; once the record has been stored, it is one
+    /// greater than that.
+    struct alignas(64) Slot {
+        std::atomic<U64>        sequence;
+        U64                     size;
+        std::unique_ptr<char[]> heap;
+        char                    data[SlotSize - 2 * sizeof(U64) - sizeof(std::unique_ptr<char[]>)];
+
+        [[nodiscard]] const char* Data() const { return heap ? heap.get() : data; }
+    };
+    static_assert(sizeof(Slot) == SlotSize);
+
+    std::unique_ptr<Slot[]>   slots;
+    U64                       capacity;
+    std::chrono::milliseconds sync_interval;
+    FD                        fd;
+    bool                      owns_fd = false;
+    _err_handler_t            err_handler;
+
+    /// Producers and the flusher each get their own cache line.
+    alignas(64) std::atomic<U64> enqueue_pos{0};
+    alignas(64) std::atomic<U64> written_pos{0}; /// Records before this have been written
+    std::atomic<U64>             synced_pos{0};  /// Records before this have been synced
+    std::atomic<U64>             sync_target{0}; /// Records before this need to be synced
+    std::atomic<bool>            flusher_sleeping{false};
+    std::atomic<bool>            failed{false}; /// A write or sync has failed
+    std::atomic<bool>            stop{false};
+    std::mutex                   mutex;
+    std::condition_variable      wakeup;
+    std::thread                  flusher;
+
+    /** Claim a slot; returns false if `block' is false and there is none */
+    bool Enqueue(std::string_view record, bool block);
+
+    /** Wake the flusher if it is waiting for records */
+    void Wake();
+
+    /** Main loop of the flusher thread */
+    void Flusher();
+
+    /** Write up to IOV_MAX queued records; returns how many were written */
+    U64 WriteBatch();
+
+    /** fdatasync() the file and record how far it has been synced */
+    void Sync();
+
+public:
+    /**
+     * Create a log that appends to an open file
+     * <p>
+     * The file descriptor is not closed by the log.
+     */
+    explicit AppendLog(FD fd, AppendLogOptions options = {}, _err_handler_t = _libutils_terminate);
+
+    /** Open or create a file and append to it */
+    explicit AppendLog(const std::string& path, AppendLogOptions options = {}, _err_handler_t = _libutils_terminate);
+
+    /** Write all queued records, sync them if syncing is enabled, and stop the flusher */
+    ~AppendLog();
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(AppendLog);
+
+    /** Queue a record, waiting for space if the log is full */
+    void Append(std::string_view record) { Enqueue(record, true); }
+
+    /**
+     * Queue a record unless the log is full
+     * @return Whether the record was queued
+     */
+    bool TryAppend(std::string_view record) { return Enqueue(record, false); }
+
+    /**
+     * Wait until every record appended so far has been written
+     * <p>
+     * Records that couldn't be written are dropped after the error handler
+     * has been called, so they count as written here as well.
+     * @param sync Whether to also wait until they have been synced to disk
+     * @return False if any write or sync has failed since the log was created
+     */
+    bool Flush(bool sync = false);
+};
+
+LIBUTILS_NAMESPACE_END
+
+#endif // UTILS_APPEND_LOG_H
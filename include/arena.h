@@ -0,0 +1,146 @@
+#ifndef UTILS_ARENA_H
+#define UTILS_ARENA_H
+
+#include "./utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <string_view>
+#include <type_traits>
+
+LIBUTILS_NAMESPACE_BEGIN
+
+/**
+ * A region-based bump allocator
+ * <p>
+ * Memory is handed out from large chunks by bumping a pointer, and is only
+ * ever freed all at once, either by calling Reset() or Release(), or when
+ * the arena is destroyed. Deallocating individual objects is a no-op.
+ * <p>
+ * This is a std::pmr::memory_resource, so it can be used with any pmr
+ * container, e.g. `std::pmr::string s{&arena};'. An arena is not thread-safe.
+ */
+class Arena : public std::pmr::memory_resource {
+    /** A chunk of memory; the usable memory follows the header */
+    struct Chunk {
+        Chunk* next; /// The previously allocated chunk
+        U64    size; /// The size of this chunk, including the header
+    };
+
+    /** The chunks we own; the first one is the one we're allocating from */
+    Chunk* chunks = nullptr;
+
+    /** Chunks that each hold a single large allocation; Reset() always frees these */
+    Chunk* large_chunks = nullptr;
+
+    /** The next free byte in the current chunk */
+    char* ptr = nullptr;
+
+    /** The end of the current chunk */
+    char* end = nullptr;
+
+    /** The size of the next chunk we allocate */
+    U64 next_chunk_size;
+
+    /** The size of the first chunk */
+    U64 initial_chunk_size;
+
+    /** Total number of bytes allocated by users of this arena */
+    U64 bytes_used{};
+
+    /** Where we get our chunks from */
+    std::pmr::memory_resource* upstream;
+
+    /** Allocate from a new chunk if the current one is full */
+    void* AllocateSlow(U64 size, U64 align);
+
+    /** Allocate a chunk of `size' bytes, including the header, and add it to the front of `list' */
+    Chunk* NewChunk(U64 size, Chunk*& list);
+
+    /** Free all chunks, except the oldest regular chunk if `keep_oldest' is true */
+    void FreeChunks(bool keep_oldest);
+
+protected:
+    void* do_allocate(std::size_t size, std::size_t align) override { return Allocate(size, align); }
+    void  do_deallocate(void*, std::size_t, std::size_t) override {}
+    bool  do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+public:
+    /** Chunks never grow beyond this size; larger allocations get a chunk of their own */
+    static constexpr U64 MaxChunkSize = U64(1) << 26;
+
+    /**
+     * Create a new arena
+     * <p>
+     * No memory is allocated until the first allocation.
+     * @param chunk_size The size of the first chunk; subsequent chunks grow geometrically
+     * @param upstream The memory resource that chunks are allocated from
+     */
+    explicit Arena(U64 chunk_size = 64 * 1024, std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+    ~Arena() override;
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(Arena);
+
+    /**
+     * Allocate memory
+     * @param size The number of bytes to allocate
+     * @param align The alignment of the memory; must be a power of two
+     * @return A pointer to the memory, which stays valid until the arena is reset
+     */
+    void* Allocate(U64 size, U64 align = alignof(std::max_align_t)) {
+        const auto aligned = (reinterpret_cast<std::uintptr_t>(ptr) + (align - 1)) & ~std::uintptr_t(align - 1);
+        if (!ptr || size > U64(reinterpret_cast<std::uintptr_t>(end) - aligned) || aligned > reinterpret_cast<std::uintptr_t>(end))
+            return AllocateSlow(size, align);
+        ptr = reinterpret_cast<char*>(aligned + size);
+        bytes_used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    /**
+     * Construct an object in the arena
+     * <p>
+     * The destructor of the object is never called, so this is
+     * only allowed for trivially destructible types.
+     * @return A pointer to the object
+     */
+    template <typename T, typename... Args>
+    T* New(Args&&... args) {
+        static_assert(std::is_trivially_destructible_v<T>, "Arena::New() does not call destructors");
+        return new (Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    /**
+     * Copy a string into the arena
+     * @param str The string to copy
+     * @return A view of the copy, which is followed by a NUL character
+     */
+    template <typename TChar>
+    std::basic_string_view<TChar> Copy(std::basic_string_view<TChar> str) {
+        auto* mem = static_cast<TChar*>(Allocate((str.size() + 1) * sizeof(TChar), alignof(TChar)));
+        std::char_traits<TChar>::copy(mem, str.data(), str.size());
+        mem[str.size()] = TChar{};
+        return {mem, str.size()};
+    }
+
+    std::string_view    Copy(const std::string& str) { return Copy(std::string_view{str}); }
+    std::u32string_view Copy(const String& str) { return Copy(std::u32string_view{str}); }
+
+    /**
+     * Free everything that was allocated from this arena
+     * <p>
+     * The first chunk is kept so that the arena can be reused without
+     * going back to the upstream resource; all other chunks, including
+     * those that were allocated for large allocations, are freed.
+     */
+    void Reset();
+
+    /** Free everything that was allocated from this arena, including the first chunk */
+    void Release();
+
+    /** The number of bytes that were allocated from this arena since it was last reset */
+    [[nodiscard]] U64 BytesUsed() const { return bytes_used; }
+};
+
+LIBUTILS_NAMESPACE_END
+
+#endif // UTILS_ARENA_H
@@ -0,0 +1,176 @@
+#ifndef UTILS_ASYNC_H
+#define UTILS_ASYNC_H
+
+#include "./coroutine.h"
+#include "./file.h"
+#include "./utils.h"
+
+#include <coroutine>
+#include <memory>
+#include <span>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+class IOEngine;
+
+/**
+ * An asynchronous I/O operation
+ * <p>
+ * These are created by the Async*() functions of IOEngine and must be
+ * co_await'ed immediately. Awaiting an operation yields its result: the
+ * return value of the corresponding system call on success, or a negated
+ * errno value on failure, as with io_uring.
+ */
+struct IOOperation {
+    enum struct Kind : U8 {
+        Read,
+        Write,
+        Open,
+        Close,
+    };
+
+    IOEngine*               engine;
+    Kind                    kind;
+    FD                      fd{-1};
+    void*                   buffer{};
+    U64                     length{};
+    U64                     offset{};
+    std::string             path{};
+    int                     flags{};
+    mode_t                  mode{};
+    I64                     result{};
+    std::coroutine_handle<> waiter{};
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h);
+    I64  await_resume() const noexcept { return result; }
+};
+
+/**
+ * An engine that runs coroutines that perform asynchronous file I/O
+ * <p>
+ * The engine uses io_uring if the kernel supports it, and a pool of worker
+ * threads that perform blocking system calls otherwise. Either way, the
+ * coroutines themselves are only ever resumed on the thread that calls Run().
+ * <p>
+ * Operations started by coroutines are not submitted right away; instead,
+ * they are collected and submitted in a single batch once every runnable
+ * coroutine has suspended. This makes it cheap to keep hundreds of
+ * operations in flight from a single thread.
+ * <p>
+ * An engine must only be used from one thread.
+ */
+class IOEngine {
+public:
+    /** How operations are executed */
+    enum struct Backend {
+        IOUring,
+        ThreadPool,
+    };
+
+    /** Use the current file position instead of an explicit offset */
+    static constexpr U64 CurrentPosition = ~U64(0);
+
+private:
+    friend IOOperation;
+    struct URing;
+    struct ThreadPool;
+
+    std::unique_ptr<URing>      ring;
+    std::unique_ptr<ThreadPool> pool;
+    std::vector<co_task<>>      tasks;
+    std::vector<IOOperation*>   queued;    /// Operations that haven't been submitted yet
+    std::vector<IOOperation*>   completed; /// Completions whose coroutines haven't been resumed yet
+    U64                         in_flight{};
+    _err_handler_t              err_handler;
+
+    /** Add an operation to the next batch */
+    void Queue(IOOperation* op);
+
+    /**
+     * Submit everything that is queued in the ring and optionally wait for
+     * completions; if that fails, fail the operations that weren't submitted
+     * @return Whether io_uring_enter() succeeded
+     */
+    bool Submit(U32 min_complete);
+
+    /** Submit the current batch, wait for at least one completion, and resume its waiters */
+    void Step();
+
+    /** Destroy finished tasks; rethrow the first exception, if any */
+    void Reap();
+
+public:
+    /**
+     * Create an engine
+     * @param queue_depth The maximum number of operations that are submitted in one batch
+     * @param use_io_uring Whether to try io_uring; if false, always use the thread pool
+     */
+    explicit IOEngine(U32 queue_depth = 256, bool use_io_uring = true, _err_handler_t = _libutils_terminate);
+    ~IOEngine();
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(IOEngine);
+
+    /** Which backend this engine uses */
+    [[nodiscard]] Backend GetBackend() const { return ring ? Backend::IOUring : Backend::ThreadPool; }
+
+    /** Read into a buffer; see pread(2) */
+    [[nodiscard]] IOOperation AsyncRead(FD fd, std::span<std::byte> buffer, U64 offset = CurrentPosition) {
+        return {.engine = this, .kind = IOOperation::Kind::Read, .fd = fd, .buffer = buffer.data(), .length = buffer.size(), .offset = offset};
+    }
+
+    /** Write a buffer; see pwrite(2) */
+    [[nodiscard]] IOOperation AsyncWrite(FD fd, std::span<const std::byte> buffer, U64 offset = CurrentPosition) {
+        return {.engine = this, .kind = IOOperation::Kind::Write, .fd = fd, .buffer = const_cast<std::byte*>(buffer.data()), .length = buffer.size(), .offset = offset};
+    }
+
+    /** Open a file; the result is the new file descriptor; see open(2) */
+    [[nodiscard]] IOOperation AsyncOpen(std::string path, int flags = O_RDONLY, mode_t mode = 0644) {
+        return {.engine = this, .kind = IOOperation::Kind::Open, .path = std::move(path), .flags = flags, .mode = mode};
+    }
+
+    /** Close a file descriptor; see close(2) */
+    [[nodiscard]] IOOperation AsyncClose(FD fd) {
+        return {.engine = this, .kind = IOOperation::Kind::Close, .fd = fd};
+    }
+
+    /**
+     * Start running a coroutine
+     * <p>
+     * The coroutine runs until it first suspends; Run() must be
+     * called to run it to completion.
+     */
+    void Spawn(co_task<> task);
+
+    /**
+     * Run until all spawned coroutines have finished
+     * <p>
+     * Coroutines can only be resumed by the engine if they are waiting for
+     * an operation of this engine, directly or through other tasks. If all
+     * remaining coroutines are waiting for something else, the error handler
+     * is called and Run() returns without finishing them.
+     * @throw Whatever a spawned coroutine threw
+     */
+    void Run();
+
+    /**
+     * Run a coroutine to completion, as well as any coroutines spawned by it
+     * @return The result of the coroutine
+     */
+    template <typename T>
+    T Run(co_task<T> task) {
+        static_cast<typename co_task<T>::co_handle>(task).resume();
+        while (!task.done()) {
+            /// See Run(); there is no result to return in this case.
+            if (!in_flight) {
+                err_handler("IOEngine::Run(): task is suspended on something other than an I/O operation");
+                std::terminate();
+            }
+            Step();
+        }
+        Run();
+        return task.result();
+    }
+};
+
+#endif // UTILS_ASYNC_H
@@ -1,8 +1,12 @@
 #ifndef UTILS_COROUTINE_H
 #define UTILS_COROUTINE_H
+#include <concepts>
 #include <coroutine>
 #include <exception>
 #include <iterator>
+#include <optional>
+#include <type_traits>
+#include <utility>
 
 template<typename T>
 struct co_generator {
@@ -67,4 +71,91 @@ public:
     const sentinel& end() { return _sentinel; }
 };
 
+/**
+ * A lazily started coroutine that produces a single value
+ * <p>
+ * The coroutine starts running when it is first awaited; once it
+ * finishes, the awaiting coroutine is resumed with its result. Exceptions
+ * are propagated to the awaiting coroutine.
+ */
+template<typename T = void>
+struct co_task {
+    struct promise_type;
+    using co_handle = std::coroutine_handle<promise_type>;
+private:
+    co_handle handle;
+
+    struct promise_base {
+        std::coroutine_handle<> continuation;
+        std::exception_ptr      exception;
+
+        /// Resume whoever awaited us, if anyone.
+        struct final_awaiter {
+            bool await_ready() noexcept { return false; }
+            std::coroutine_handle<> await_suspend(co_handle h) noexcept {
+                auto c = h.promise().continuation;
+                return c ? c : std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        final_awaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { exception = std::current_exception(); }
+    };
+
+    struct promise_value : promise_base {
+        std::optional<T> value;
+        template<std::convertible_to<T> U>
+        void return_value(U&& u) { value.emplace(std::forward<U>(u)); }
+    };
+
+    struct promise_void : promise_base {
+        void return_void() {}
+    };
+
+public:
+    struct promise_type : std::conditional_t<std::is_void_v<T>, promise_void, promise_value> {
+        co_task get_return_object() { return co_task{co_handle::from_promise(*this)}; }
+    };
+
+    explicit co_task(co_handle h) : handle(h) {}
+    co_task(const co_task&) = delete;
+    co_task(co_task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    co_task& operator=(co_task&& other) noexcept {
+        if (this != &other) {
+            if (handle) handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~co_task() { if (handle) handle.destroy(); }
+    operator co_handle() const { return handle; }
+
+    /** Whether the coroutine has finished running */
+    bool done() const { return !handle || handle.done(); }
+
+    /** Get the result of a finished coroutine, rethrowing its exception, if any */
+    T result() {
+        if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+        if constexpr (!std::is_void_v<T>) return std::move(*handle.promise().value);
+    }
+
+    auto operator co_await() && noexcept {
+        struct awaiter {
+            co_handle handle;
+            bool await_ready() noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() {
+                if (handle.promise().exception) std::rethrow_exception(handle.promise().exception);
+                if constexpr (!std::is_void_v<T>) return std::move(*handle.promise().value);
+            }
+        };
+        return awaiter{handle};
+    }
+};
+
 #endif // UTILS_COROUTINE_H
@@ -3,12 +3,27 @@
 #include "./coroutine.h"
 #include "./utils.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <concepts>
 #include <cstring>
 #include <fcntl.h>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <thread>
 #include <unistd.h>
 #include <utility>
+#include <vector>
 
 enum struct FileMode : char8_t {
     R  = 1,
@@ -16,17 +31,76 @@ enum struct FileMode : char8_t {
     RW = 3,
 };
 template <FileMode m>
-concept Writable = requires { (char8_t(m) & char8_t(FileMode::W)) != 0; };
+concept Writable = (char8_t(m) & char8_t(FileMode::W)) != 0;
 
 template <FileMode m>
-concept Readable = requires { (char8_t(m) & char8_t(FileMode::R)) != 0; };
+concept Readable = (char8_t(m) & char8_t(FileMode::R)) != 0;
 
 using FD = int;
 
+/**
+ * Write all of the buffers to a file descriptor
+ * <p>
+ * Partial writes are continued and interrupted writes are retried.
+ * The iovecs are modified in the process.
+ * @return Whether everything was written; if not, `handler' has been called
+ */
+bool _libutils_write_all(FD fd, iovec* iov, U64 count, const _err_handler_t& handler);
+
+/**
+ * Write all of the buffers to a file descriptor at an offset
+ * <p>
+ * Like _libutils_write_all(), but uses pwritev().
+ */
+bool _libutils_pwrite_all(FD fd, iovec* iov, U64 count, U64 offset, const _err_handler_t& handler);
+
+/**
+ * Copy data between file descriptors without going through user space
+ * <p>
+ * Uses copy_file_range() between regular files, sendfile() from regular
+ * files, and splice() if either end is a pipe, in that order, and falls
+ * back to reading and writing through a buffer if none of them work.
+ * @return The number of bytes copied; if this is less than `n' and EOF
+ *         wasn't reached, `handler' has been called
+ */
+U64 _libutils_copy(FD from, FD to, U64 n, const _err_handler_t& handler);
+
+/**
+ * Move data between file descriptors using splice()
+ * <p>
+ * If neither end is a pipe, the data is moved through an intermediate
+ * pipe, which works for e.g. sockets, where sendfile() doesn't.
+ * @see _libutils_copy()
+ */
+U64 _libutils_splice(FD from, FD to, U64 n, const _err_handler_t& handler);
+
+/**
+ * Copy data to two file descriptors, using tee() if possible
+ * @see _libutils_copy()
+ */
+U64 _libutils_tee(FD from, FD first, FD second, U64 n, const _err_handler_t& handler);
+
+/**
+ * Start a child process with the given standard streams
+ * <p>
+ * This uses posix_spawn(), which is implemented with vfork() semantics
+ * and doesn't copy the parent's page tables.
+ * @param file The program to run; if it contains no '/', it is looked up in $PATH
+ * @param argv The null-terminated argument vector
+ * @param envp The null-terminated environment
+ * @param cwd The working directory of the child, or nullptr to inherit ours
+ * @param stdio The file descriptors that become the child's stdin, stdout, and stderr
+ * @param close_fds Whether to close all other file descriptors in the child, even
+ *        those that are not close-on-exec
+ * @return The process ID of the child, or -1 and errno is set
+ */
+pid_t _libutils_spawn(const char* file, char* const argv[], char* const envp[], const char* cwd, const FD (&stdio)[3], bool close_fds);
+
 template <FileMode mode = FileMode::RW>
 struct File {
     FD                          fd       = -1;
-    static constexpr inline U64 _bufsize = 8192;
+    static constexpr inline U64 _bufsize       = 8192;
+    static constexpr inline U64 _min_read_size = 64 * 1024;
     _err_handler_t              err_handler;
 
     void Close() {
@@ -35,64 +109,352 @@ struct File {
         if (close(fd) < 0) err_handler(std::string{"Close: "} + strerror(errno));
     }
 
-    [[nodiscard]] std::string Drain() const requires Readable<mode> {
+    /**
+     * How much to allocate for the first read() when reading to EOF
+     * <p>
+     * For regular files, this is what is left of the file, plus one byte so
+     * that the read() that returns EOF doesn't make us grow; for anything
+     * else, it is _min_read_size.
+     */
+    [[nodiscard]] U64 _InitialReadSize() const {
+        struct stat st {};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            /// Files in e.g. /proc report a size of 0, so only trust non-zero sizes.
+            const off_t pos = lseek(fd, 0, SEEK_CUR);
+            if (pos >= 0 && st.st_size > pos) return U64(st.st_size - pos) + 1;
+        }
+        return _min_read_size;
+    }
+
+    /**
+     * Read everything up to EOF
+     * <p>
+     * For regular files, the output is sized from fstat() up front so that
+     * the entire file is read with a single read(); for pipes, sockets, etc.,
+     * reads start at 64 KiB and grow geometrically.
+     * @param max_size The maximum number of bytes to read
+     * @return The bytes read, or an empty string on error
+     */
+    [[nodiscard]] std::string Drain(U64 max_size = UINT64_MAX) const requires Readable<mode> {
         std::string out;
-        void*       buf = malloc(_bufsize);
-        I64         n_read;
-        do {
-            n_read = read(fd, buf, _bufsize);
-            if (n_read < 0) goto err;
-            out.append((char*) buf, U64(n_read));
-        } while (n_read == _bufsize);
-        free(buf);
+        U64         size = 0;
+        while (size < max_size) {
+            if (size == out.size()) {
+                const U64 grow = out.empty() ? _InitialReadSize() : std::max(out.size() * 2, _min_read_size);
+                out.resize(std::min(max_size, grow));
+            }
+            const I64 n_read = read(fd, out.data() + size, out.size() - size);
+            if (n_read == 0) break;
+            if (n_read < 0) {
+                if (errno == EINTR) continue;
+                err_handler(std::string{"read(): "} + std::strerror(errno));
+                return "";
+            }
+            size += U64(n_read);
+        }
+
+        out.resize(size);
         return out;
-    err:
-        free(buf);
-        err_handler(std::strerror(errno));
-        return "";
     }
 
+    /**
+     * Iterate over the lines of the file without copying them
+     * <p>
+     * Lines are yielded without the terminating newline; a final line that
+     * isn't terminated by a newline is yielded only if it isn't empty. The
+     * views point into a buffer that is reused as the file is read, so they
+     * are only valid until the generator is advanced.
+     * @param strip_cr Whether to also remove the '\r' of a CRLF line ending
+     */
+    [[nodiscard]] co_generator<std::string_view> LineViews(bool strip_cr = true) const requires Readable<mode> {
+        std::string buf;
+        buf.resize(64 * 1024);
+        U64  start = 0; /// Start of the current line
+        U64  scan  = 0; /// Where to continue looking for a newline
+        U64  end   = 0; /// End of the data in the buffer
+        bool eof   = false;
+        for (;;) {
+            /// memchr() is vectorised, and lines are usually short, so
+            /// this is faster than any line-at-a-time approach.
+            while (const void* nl = std::memchr(buf.data() + scan, '\n', end - scan)) {
+                const U64 pos = U64(static_cast<const char*>(nl) - buf.data());
+                U64       len = pos - start;
+                if (strip_cr && len && buf[pos - 1] == '\r') len--;
+                co_yield std::string_view{buf.data() + start, len};
+                start = scan = pos + 1;
+            }
+            scan = end;
+            if (eof) break;
+
+            /// Move the partial line to the front of the buffer, and only
+            /// grow the buffer if a single line doesn't fit into it.
+            if (start) {
+                std::memmove(buf.data(), buf.data() + start, end - start);
+                end -= start;
+                scan -= start;
+                start = 0;
+            }
+            if (end == buf.size()) buf.resize(buf.size() * 2);
+
+            const I64 n_read = read(fd, buf.data() + end, buf.size() - end);
+            if (n_read < 0) {
+                if (errno == EINTR) continue;
+                err_handler(std::string{"read(): "} + std::strerror(errno));
+                co_return;
+            }
+            if (n_read == 0) eof = true;
+            end += U64(n_read);
+        }
+
+        if (start < end) co_yield std::string_view{buf.data() + start, end - start};
+    }
+
+    /**
+     * Iterate over the lines of the file
+     * <p>
+     * Like LineViews(), but yields copies of each line, and keeps
+     * the '\r' of CRLF line endings.
+     */
     [[nodiscard]] co_generator<std::string> Lines() const requires Readable<mode> {
-        char*       buf = (char*) malloc(4096);
-        I64         n_read;
+        for (auto line : LineViews(false)) co_yield std::string{line};
+    }
+
+    /**
+     * Read up to `buffer.size()' bytes into a buffer
+     * <p>
+     * This performs at most one successful read(), retrying if it is
+     * interrupted by a signal, and may thus return fewer bytes than
+     * requested even if EOF has not been reached yet.
+     * @param buffer The buffer to read into
+     * @return The number of bytes read, or 0 on EOF or error
+     */
+    U64 ReadInto(std::span<std::byte> buffer) const requires Readable<mode> {
+        for (;;) {
+            const I64 n_read = read(fd, buffer.data(), buffer.size());
+            if (n_read >= 0) return U64(n_read);
+            if (errno == EINTR) continue;
+            err_handler(std::string{"read(): "} + std::strerror(errno));
+            return 0;
+        }
+    }
+
+    /**
+     * Fill a buffer completely
+     * <p>
+     * Unlike ReadInto(), this keeps reading until the buffer is full.
+     * @param buffer The buffer to read into
+     * @return The number of bytes read, which is less than `buffer.size()'
+     *         only if EOF was reached or an error occurred
+     */
+    U64 ReadExact(std::span<std::byte> buffer) const requires Readable<mode> {
+        U64 total = 0;
+        while (total < buffer.size()) {
+            const U64 n_read = ReadInto(buffer.subspan(total));
+            if (!n_read) break;
+            total += n_read;
+        }
+        return total;
+    }
+
+    /**
+     * Scatter read into multiple buffers using readv()
+     * <p>
+     * Like ReadInto(), this may return fewer bytes than requested.
+     * @param buffers The buffers to read into, in order
+     * @return The number of bytes read, or 0 on EOF or error
+     */
+    U64 ReadV(std::span<const iovec> buffers) const requires Readable<mode> {
+        const int count = int(std::min<U64>(buffers.size(), IOV_MAX));
+        for (;;) {
+            const I64 n_read = readv(fd, buffers.data(), count);
+            if (n_read >= 0) return U64(n_read);
+            if (errno == EINTR) continue;
+            err_handler(std::string{"readv(): "} + std::strerror(errno));
+            return 0;
+        }
+    }
+
+    /**
+     * Read up to `buffer.size()' bytes at an offset
+     * <p>
+     * Like ReadInto(), but reads at `offset' instead of the current
+     * position, which is neither used nor changed. Since there is no
+     * shared state, any number of threads can call this concurrently
+     * on the same file.
+     * @param buffer The buffer to read into
+     * @param offset Where in the file to start reading
+     * @return The number of bytes read, or 0 on EOF or error
+     */
+    U64 PRead(std::span<std::byte> buffer, U64 offset) const requires Readable<mode> {
+        for (;;) {
+            const I64 n_read = pread(fd, buffer.data(), buffer.size(), off_t(offset));
+            if (n_read >= 0) return U64(n_read);
+            if (errno == EINTR) continue;
+            err_handler(std::string{"pread(): "} + std::strerror(errno));
+            return 0;
+        }
+    }
+
+    /**
+     * Fill a buffer completely from an offset
+     * <p>
+     * Like ReadExact(), but for PRead().
+     * @return The number of bytes read, which is less than `buffer.size()'
+     *         only if EOF was reached or an error occurred
+     */
+    U64 PReadExact(std::span<std::byte> buffer, U64 offset) const requires Readable<mode> {
+        U64 total = 0;
+        while (total < buffer.size()) {
+            const U64 n_read = PRead(buffer.subspan(total), offset + total);
+            if (!n_read) break;
+            total += n_read;
+        }
+        return total;
+    }
+
+    /**
+     * Scatter read into multiple buffers at an offset using preadv()
+     * <p>
+     * Like ReadV(), but doesn't use or change the current position.
+     */
+    U64 PReadV(std::span<const iovec> buffers, U64 offset) const requires Readable<mode> {
+        const int count = int(std::min<U64>(buffers.size(), IOV_MAX));
+        for (;;) {
+            const I64 n_read = preadv(fd, buffers.data(), count, off_t(offset));
+            if (n_read >= 0) return U64(n_read);
+            if (errno == EINTR) continue;
+            err_handler(std::string{"preadv(): "} + std::strerror(errno));
+            return 0;
+        }
+    }
+
+    /**
+     * Read a range of the file
+     * <p>
+     * This is Read() for an explicit offset, and, like PRead(), is
+     * safe to call from multiple threads at once.
+     * @param offset Where in the file the range starts
+     * @param n The size of the range
+     * @return The bytes read, which are fewer than `n' only if EOF
+     *         was reached or an error occurred
+     */
+    [[nodiscard]] std::string ReadAt(U64 offset, U64 n) const requires Readable<mode> {
         std::string out;
-        do {
-            n_read = read(fd, buf, _bufsize);
-            if (n_read < 0) goto err;
+        out.resize(n);
+        out.resize(PReadExact(std::as_writable_bytes(std::span{out}), offset));
+        return out;
+    }
 
-            char *pos = buf, *start;
-            for (;;) {
-                start = pos;
-                pos   = (char*) memchr(pos, '\n', U64(n_read));
-                if (!pos) {
-                    out.append(start, U64(n_read));
-                    break;
-                }
-                out.append(start, U64(pos - start));
-                co_yield out;
-                out.clear();
-                n_read -= pos - start + 1;
-                pos++;
+    /**
+     * Read up to `n' bytes
+     * <p>
+     * This reads until `n' bytes have been read or EOF is reached. Like
+     * Drain(), the output is sized from what is left of a regular file, and
+     * grows as data arrives otherwise, so a large `n' costs nothing if there
+     * is less to read; use ReadInto() to read into a buffer that you
+     * already have.
+     * @param n The maximum number of bytes to read; if this is UINT64_MAX,
+     *          the entire file is read, as with Drain()
+     * @return The bytes read
+     */
+    [[nodiscard]] std::string Read(U64 n = UINT64_MAX) const requires Readable<mode> {
+        if (n == UINT64_MAX) return Drain();
+        std::string out;
+        U64         size = 0;
+        while (size < n) {
+            if (size == out.size()) {
+                const U64 grow = out.empty() ? _InitialReadSize() : std::max(out.size() * 2, _min_read_size);
+                out.resize(std::min(n, grow));
             }
-        } while (U64(n_read) == _bufsize);
-        free(buf);
-        if (!out.empty()) co_yield out;
-        co_return;
-    err:
-        free(buf);
-        err_handler(std::strerror(errno));
-        co_return;
+            const U64 n_read = ReadInto(std::as_writable_bytes(std::span{out}).subspan(size));
+            if (!n_read) break;
+            size += n_read;
+        }
+        out.resize(size);
+        return out;
     }
 
-    [[nodiscard]] std::string Read(U64 n = UINT64_MAX) const requires Readable<mode> {
-        (void) n;
-        ConstexprNotImplemented("File::Read()");
-        return "";
+    /**
+     * Write a string to the file
+     * <p>
+     * This keeps writing until everything has been written or an error occurs.
+     * @param str The string to write
+     * @param n The maximum number of bytes of `str' to write
+     */
+    void Write(std::string_view str, U64 n = UINT64_MAX) const requires Writable<mode> {
+        iovec iov{const_cast<char*>(str.data()), std::min(str.size(), n)};
+        _libutils_write_all(fd, &iov, 1, err_handler);
+    }
+
+    /**
+     * Write a string at an offset
+     * <p>
+     * Like Write(), but writes at `offset' instead of the current
+     * position, which is neither used nor changed; multiple threads
+     * can write to different parts of a file concurrently. Note that
+     * on Linux, the offset is ignored if the file was opened with
+     * O_APPEND.
+     * @return Whether everything was written
+     */
+    bool PWrite(std::string_view str, U64 offset) const requires Writable<mode> {
+        iovec iov{const_cast<char*>(str.data()), str.size()};
+        return _libutils_pwrite_all(fd, &iov, 1, offset, err_handler);
+    }
+
+    /**
+     * Gather write multiple buffers at an offset using pwritev()
+     * <p>
+     * Partial writes are continued, as with PWrite().
+     * @return Whether everything was written
+     */
+    bool PWriteV(std::span<const iovec> buffers, U64 offset) const requires Writable<mode> {
+        /// The iovecs are modified as partial writes are continued.
+        if (buffers.size() <= 16) {
+            iovec copy[16];
+            std::copy(buffers.begin(), buffers.end(), copy);
+            return _libutils_pwrite_all(fd, copy, buffers.size(), offset, err_handler);
+        }
+        std::vector<iovec> copy{buffers.begin(), buffers.end()};
+        return _libutils_pwrite_all(fd, copy.data(), copy.size(), offset, err_handler);
+    }
+
+    /**
+     * Copy the rest of this file to another file
+     * <p>
+     * This starts at the current position of both files and, if possible,
+     * doesn't copy the data through user space; see _libutils_copy().
+     * @param dest The file to copy to
+     * @param n The maximum number of bytes to copy
+     * @return The number of bytes copied
+     */
+    template <FileMode dest_mode>
+    U64 CopyTo(const File<dest_mode>& dest, U64 n = UINT64_MAX) const requires Readable<mode> && Writable<dest_mode> {
+        return _libutils_copy(fd, dest.fd, n, err_handler);
+    }
+
+    /**
+     * Move the rest of this file to another file using splice()
+     * <p>
+     * Like CopyTo(), but always uses splice() if the kernel supports it for
+     * these files, even if neither of them is a pipe; this is the fastest
+     * way to move data from a socket to a file.
+     */
+    template <FileMode dest_mode>
+    U64 SpliceTo(const File<dest_mode>& dest, U64 n = UINT64_MAX) const requires Readable<mode> && Writable<dest_mode> {
+        return _libutils_splice(fd, dest.fd, n, err_handler);
     }
 
-    void Write(const std::string& str, U64 n = UINT64_MAX) const requires Writable<mode> {
-        U64 sz = std::min(str.size(), n);
-        write(fd, str.c_str(), sz);
+    /**
+     * Copy the rest of this file to two files
+     * <p>
+     * If this file and `first' are pipes, the data is duplicated with
+     * tee() and never copied through user space.
+     * @return The number of bytes read from this file
+     */
+    template <FileMode first_mode, FileMode second_mode>
+    U64 TeeTo(const File<first_mode>& first, const File<second_mode>& second, U64 n = UINT64_MAX) const
+    requires Readable<mode> && Writable<first_mode> && Writable<second_mode> {
+        return _libutils_tee(fd, first.fd, second.fd, n, err_handler);
     }
 
     explicit File(_err_handler_t _err_handler = _libutils_terminate)
@@ -123,6 +485,330 @@ struct File {
 using OFile = File<FileMode::W>;
 using IFile = File<FileMode::R>;
 
+/** Access pattern hints for MappedFile; see madvise(2) */
+enum struct MapAdvice : int {
+    Normal     = MADV_NORMAL,
+    Sequential = MADV_SEQUENTIAL,
+    Random     = MADV_RANDOM,
+    WillNeed   = MADV_WILLNEED,
+    DontNeed   = MADV_DONTNEED,
+};
+
+/** How a MappedFile is mapped */
+struct MapOptions {
+    MapAdvice advice     = MapAdvice::Normal; /// How the mapping is going to be accessed
+    bool      populate   = false;             /// Fault in the entire file up front (MAP_POPULATE)
+    bool      huge_pages = false;             /// Ask for transparent huge pages (MADV_HUGEPAGE)
+};
+
+/**
+ * A file that is mapped into memory
+ * <p>
+ * Read-only mappings are private; read-write mappings are shared, so
+ * writes to the mapping end up in the file. The mapping is removed when
+ * the MappedFile is destroyed. An empty file yields a valid, empty mapping.
+ */
+template <FileMode mode = FileMode::R>
+class MappedFile {
+    static_assert(Readable<mode>, "A MappedFile must be readable");
+
+    std::byte* data = nullptr;
+    U64        size{};
+    bool       valid = false;
+
+    void Map(FD fd, const MapOptions& opts) {
+        struct stat st {};
+        if (fstat(fd, &st) < 0) {
+            err_handler(std::string{"fstat(): "} + std::strerror(errno));
+            return;
+        }
+
+        if (st.st_size > 0) {
+            const int prot  = Writable<mode> ? PROT_READ | PROT_WRITE : PROT_READ;
+            const int flags = (Writable<mode> ? MAP_SHARED : MAP_PRIVATE) | (opts.populate ? MAP_POPULATE : 0);
+            void*     mem   = mmap(nullptr, U64(st.st_size), prot, flags, fd, 0);
+            if (mem == MAP_FAILED) {
+                err_handler(std::string{"mmap(): "} + std::strerror(errno));
+                return;
+            }
+            data = static_cast<std::byte*>(mem);
+            size = U64(st.st_size);
+
+            /// These are only hints, so ignore errors.
+            if (opts.huge_pages) madvise(data, size, MADV_HUGEPAGE);
+            if (opts.advice != MapAdvice::Normal) Advise(opts.advice);
+        }
+        valid = true;
+    }
+
+    void Unmap() {
+        if (data) munmap(data, size);
+        data  = nullptr;
+        size  = 0;
+        valid = false;
+    }
+
+public:
+    _err_handler_t err_handler;
+
+    /**
+     * Map an open file
+     * <p>
+     * The file descriptor is not needed after this returns and
+     * is not closed by the MappedFile.
+     */
+    explicit MappedFile(FD fd, MapOptions opts = {}, _err_handler_t _err_handler = _libutils_terminate)
+        : err_handler(std::move(_err_handler)) { Map(fd, opts); }
+
+    /** Open and map a file */
+    explicit MappedFile(const std::string& path, MapOptions opts = {}, _err_handler_t _err_handler = _libutils_terminate)
+        : err_handler(std::move(_err_handler)) {
+        const FD fd = open(path.c_str(), Writable<mode> ? O_RDWR : O_RDONLY);
+        if (fd < 0) {
+            err_handler(std::string{"open(): "} + std::strerror(errno));
+            return;
+        }
+        Map(fd, opts);
+        close(fd);
+    }
+
+    MappedFile(MappedFile&& other) noexcept
+        : data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)),
+          valid(std::exchange(other.valid, false)), err_handler(std::move(other.err_handler)) {}
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this == &other) return *this;
+        Unmap();
+        data        = std::exchange(other.data, nullptr);
+        size        = std::exchange(other.size, 0);
+        valid       = std::exchange(other.valid, false);
+        err_handler = std::move(other.err_handler);
+        return *this;
+    }
+
+    ~MappedFile() { Unmap(); }
+    LIBUTILS_NON_COPYABLE(MappedFile);
+
+    /** Whether the file was mapped successfully */
+    [[nodiscard]] bool Valid() const { return valid; }
+
+    /** The size of the mapping in bytes */
+    [[nodiscard]] U64 Size() const { return size; }
+
+    /** The contents of the file */
+    [[nodiscard]] std::span<const std::byte> Bytes() const { return {data, size}; }
+    [[nodiscard]] std::span<std::byte> Bytes() requires Writable<mode> { return {data, size}; }
+
+    /** The contents of the file as text */
+    [[nodiscard]] std::string_view View() const { return {reinterpret_cast<const char*>(data), size}; }
+
+    /**
+     * Tell the kernel how a range of the mapping is going to be accessed
+     * @param advice The access pattern
+     * @param offset The start of the range; rounded down to a page boundary
+     * @param length The length of the range; defaults to the rest of the file
+     */
+    void Advise(MapAdvice advice, U64 offset = 0, U64 length = UINT64_MAX) const {
+        if (offset >= size) return;
+        static const U64 page_size = U64(sysconf(_SC_PAGESIZE));
+        const U64        start     = offset & ~(page_size - 1);
+        length                     = std::min(length, size - offset) + (offset - start);
+        madvise(data + start, length, int(advice));
+    }
+
+    /**
+     * Write changes back to the file
+     * @param wait Whether to wait until the data has been written (MS_SYNC)
+     */
+    void Sync(bool wait = true) const requires Writable<mode> {
+        if (data && msync(data, size, wait ? MS_SYNC : MS_ASYNC) < 0)
+            err_handler(std::string{"msync(): "} + std::strerror(errno));
+    }
+};
+
+/**
+ * Call a function on each line of a file, using multiple threads
+ * <p>
+ * The file is mapped and split into chunks at line boundaries, which the
+ * threads then take turns processing. Each thread has its own state, so
+ * the callback doesn't need any synchronisation; once all lines have been
+ * processed, the states are combined using `reduce'.
+ * <p>
+ * Lines are passed to `fn' as with File::LineViews(), but in no particular
+ * order. If a callback throws, the remaining chunks are skipped, and the
+ * first exception is rethrown once all threads have stopped.
+ * @param path The file to read
+ * @param fn Called as `fn(state, line)' for each line
+ * @param reduce Called as `reduce(result, std::move(state))' to merge the
+ *        state of each thread into the first thread's state
+ * @param threads The maximum number of threads to use; 0 means one per CPU
+ * @return The combined state
+ */
+template <std::default_initializable State, typename LineCallback, typename Reduce>
+requires std::invocable<LineCallback&, State&, std::string_view> && std::invocable<Reduce&, State&, State&&>
+State ParallelLines(const std::string& path, LineCallback fn, Reduce reduce, U64 threads = 0, _err_handler_t err_handler = _libutils_terminate) {
+    MappedFile<> file{path, {.advice = MapAdvice::Sequential}, std::move(err_handler)};
+    if (!file.Valid() || !file.Size()) return State{};
+    const std::string_view text = file.View();
+
+    /// Use several chunks per thread so that threads that are done early can help out.
+    if (!threads) threads = std::max(1U, std::thread::hardware_concurrency());
+    const U64        chunk_size = std::max<U64>(U64(1) << 20, text.size() / (threads * 8) + 1);
+    std::vector<U64> bounds{0};
+    for (U64 pos = chunk_size; pos < text.size();) {
+        const void* nl = std::memchr(text.data() + pos, '\n', text.size() - pos);
+        if (!nl) break;
+        pos = U64(static_cast<const char*>(nl) - text.data()) + 1;
+        if (pos == text.size()) break;
+        bounds.push_back(pos);
+        pos += chunk_size;
+    }
+    bounds.push_back(text.size());
+
+    /// Keep the states on separate cache lines.
+    struct alignas(64) Slot {
+        State state{};
+    };
+
+    const U64          n_chunks = bounds.size() - 1;
+    std::vector<Slot>  slots(std::min(threads, n_chunks));
+    std::atomic<U64>   next_chunk{0};
+    std::atomic<bool>  failed{false};
+    std::exception_ptr exception;
+    std::mutex         exception_mutex;
+    const auto         Work = [&](Slot& slot) {
+        try {
+            for (;;) {
+                const U64 i = next_chunk.fetch_add(1, std::memory_order_relaxed);
+                if (i >= n_chunks || failed.load(std::memory_order_relaxed)) break;
+                for (U64 start = bounds[i], end = bounds[i + 1]; start < end;) {
+                    const void* nl  = std::memchr(text.data() + start, '\n', end - start);
+                    const U64   pos = nl ? U64(static_cast<const char*>(nl) - text.data()) : end;
+                    U64         len = pos - start;
+                    if (len && text[pos - 1] == '\r') len--;
+                    fn(slot.state, text.substr(start, len));
+                    start = pos + 1;
+                }
+            }
+        } catch (...) {
+            std::unique_lock lock{exception_mutex};
+            if (!exception) exception = std::current_exception();
+            failed.store(true, std::memory_order_relaxed);
+        }
+    };
+
+    {
+        std::vector<std::jthread> workers;
+        for (U64 t = 1; t < slots.size(); t++) workers.emplace_back(Work, std::ref(slots[t]));
+        Work(slots[0]);
+    }
+    if (exception) std::rethrow_exception(exception);
+
+    for (U64 t = 1; t < slots.size(); t++) reduce(slots[0].state, std::move(slots[t].state));
+    return std::move(slots[0].state);
+}
+
+/**
+ * Call a function on each line of a file, using multiple threads
+ * <p>
+ * Like the other overload, but without any per-thread state, so `fn'
+ * must be safe to call from multiple threads at once.
+ */
+template <typename LineCallback>
+requires std::invocable<LineCallback&, std::string_view>
+void ParallelLines(const std::string& path, LineCallback fn, U64 threads = 0, _err_handler_t err_handler = _libutils_terminate) {
+    struct Empty {};
+    ParallelLines<Empty>(
+        path,
+        [&](Empty&, std::string_view line) { fn(line); },
+        [](Empty&, Empty&&) {},
+        threads,
+        std::move(err_handler)
+    );
+}
+
+/**
+ * A buffered writer for a file descriptor
+ * <p>
+ * Small writes are collected in a buffer, which is written to the file
+ * once it is full. Pieces that are at least half as large as the buffer
+ * are not copied; instead, they are written together with the buffer
+ * using a single writev().
+ * <p>
+ * The buffer is flushed when the writer is destroyed. The file descriptor
+ * is not owned by the writer and must stay open while it is in use.
+ */
+class BufferedWriter {
+    FD                      fd;
+    std::unique_ptr<char[]> buffer;
+    U64                     capacity;
+    U64                     used{};
+
+public:
+    _err_handler_t err_handler;
+
+    static constexpr U64 DefaultBufferSize = 64 * 1024;
+
+    explicit BufferedWriter(FD _fd, U64 buffer_size = DefaultBufferSize, _err_handler_t _err_handler = _libutils_terminate)
+        : fd(_fd), buffer(new char[std::max<U64>(buffer_size, 1)]), capacity(std::max<U64>(buffer_size, 1)),
+          err_handler(std::move(_err_handler)) {}
+
+    template <FileMode mode>
+    requires Writable<mode>
+    explicit BufferedWriter(const File<mode>& file, U64 buffer_size = DefaultBufferSize)
+        : BufferedWriter(file.fd, buffer_size, file.err_handler) {}
+
+    ~BufferedWriter() { Flush(); }
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(BufferedWriter);
+
+    /** Write a string */
+    void Write(std::string_view str) {
+        if (str.size() <= capacity - used) {
+            std::memcpy(buffer.get() + used, str.data(), str.size());
+            used += str.size();
+        } else WriteSlow(str);
+    }
+
+    /** Write a single character */
+    void Write(char c) {
+        if (used == capacity) Flush();
+        buffer[used++] = c;
+    }
+
+    /** Write an integer in decimal */
+    template <std::integral Integer>
+    requires (not std::is_same_v<Integer, bool>)
+    void Write(Integer value) {
+        char       buf[24];
+        const auto res = std::to_chars(buf, buf + sizeof buf, value);
+        Write(std::string_view{buf, U64(res.ptr - buf)});
+    }
+
+    template <typename T>
+    BufferedWriter& operator<<(const T& value) requires requires { Write(value); } {
+        Write(value);
+        return *this;
+    }
+
+    /** Write everything in the buffer to the file */
+    void Flush();
+
+    /** The number of bytes in the buffer that haven't been written yet */
+    [[nodiscard]] U64 Buffered() const { return used; }
+
+private:
+    /** Write a string that doesn't fit into the buffer */
+    void WriteSlow(std::string_view str);
+};
+
+/**
+ * Run a shell command and wait for it to exit
+ * <p>
+ * The command's stdout and stderr are captured in memory files, which can
+ * then be read from `out' and `err'. Since the command has already exited
+ * by the time the constructor returns, nothing written to `in' is read; use
+ * Process to interact with a command.
+ */
 struct SynchronousPipe {
     OFile in;
     IFile out;
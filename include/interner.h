@@ -0,0 +1,111 @@
+#ifndef UTILS_INTERNER_H
+#define UTILS_INTERNER_H
+
+#include "./arena.h"
+#include "./utils.h"
+
+#include <atomic>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+LIBUTILS_NAMESPACE_BEGIN
+
+/** A 32-bit id that identifies an interned string */
+using Symbol = U32;
+
+/** A symbol that never refers to a string */
+constexpr Symbol NoSymbol = ~Symbol(0);
+
+/**
+ * A string interning table
+ * <p>
+ * Maps strings to symbols such that equal strings always get the same
+ * symbol, which allows comparing them by comparing integers. Symbols are
+ * handed out in order, starting at 0.
+ * <p>
+ * Interned strings are copied into an arena and stay valid for the lifetime
+ * of the interner. All member functions are thread-safe; Str() doesn't take
+ * a lock at all.
+ */
+template <typename TChar = Char>
+class Interner {
+public:
+    using View = std::basic_string_view<TChar>;
+
+private:
+    /** An entry in the hash table; the slot is empty if `symbol' is NoSymbol */
+    struct Slot {
+        U32    hash;
+        Symbol symbol;
+    };
+
+    /// The strings are stored in segments that never move. Segment `k' holds
+    /// FirstSegmentSize << k strings, so 23 segments suffice for every symbol.
+    static constexpr U32 FirstSegmentShift = 10;
+    static constexpr U32 FirstSegmentSize  = U32(1) << FirstSegmentShift;
+    static constexpr U32 NumSegments       = 33 - FirstSegmentShift;
+
+    /** The hash table; its size is always a power of two */
+    std::vector<Slot> slots;
+
+    /** The interned strings, indexed by symbol */
+    std::atomic<View*> segments[NumSegments]{};
+
+    /** The number of interned strings */
+    std::atomic<U32> count{};
+
+    /** Where the strings and segments are allocated from */
+    Arena arena;
+
+    /** Guards the table and the arena */
+    mutable std::shared_mutex mutex;
+
+    /** Find a string in the table; the caller must hold the lock */
+    Symbol FindLocked(View str, U32 hash) const;
+
+    /** Double the size of the table; the caller must hold the lock exclusively */
+    void Grow();
+
+    /** Get the segment and index within that segment of a symbol */
+    static std::pair<U32, U32> Locate(Symbol sym);
+
+public:
+    Interner();
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(Interner);
+
+    /**
+     * Intern a string
+     * @param str The string to intern
+     * @return The symbol of `str'; the same string always yields the same symbol
+     * @throw std::length_error if the interner has run out of symbols
+     */
+    Symbol Intern(View str);
+
+    /**
+     * Look up a string without interning it
+     * @return The symbol of `str', or NoSymbol if it hasn't been interned
+     */
+    [[nodiscard]] Symbol Find(View str) const;
+
+    /**
+     * Get the string that a symbol refers to
+     * @param sym A symbol returned by Intern()
+     * @return A view of the interned string, which is followed by a NUL character
+     */
+    [[nodiscard]] View Str(Symbol sym) const {
+        auto [seg, idx] = Locate(sym);
+        return segments[seg].load(std::memory_order_acquire)[idx];
+    }
+
+    /** The number of interned strings */
+    [[nodiscard]] U64 Size() const { return count.load(std::memory_order_acquire); }
+};
+
+extern template class Interner<char>;
+extern template class Interner<char8_t>;
+extern template class Interner<char32_t>;
+
+LIBUTILS_NAMESPACE_END
+
+#endif // UTILS_INTERNER_H
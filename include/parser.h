@@ -1,6 +1,7 @@
 #ifndef UTILS_PARSER_H
 #define UTILS_PARSER_H
 
+#include "./interner.h"
 #include "./unicode-utils.h"
 #include "./utils.h"
 
@@ -11,6 +12,7 @@
 #include <filesystem>
 #include <functional>
 #include <iostream>
+#include <memory_resource>
 #include <stack>
 #include <sys/mman.h>
 #include <sys/stat.h>
@@ -73,7 +75,7 @@ struct FileBase {
         if (mem == MAP_FAILED) HandleError("mmap()");
 
         if constexpr (std::is_same_v<TChar, char8_t>) contents = mem;
-        else contents = ToUTF32(mem);
+        else contents = ToUTF32(std::string_view{mem, sz});
 
         if (::munmap(mem, sz)) HandleError("munmap()");
         if (::close(fd)) HandleError("close()");
@@ -175,25 +177,42 @@ struct SourceLocationBase {
 
 std::ostream& operator<<(std::ostream& stream, const SourceLocationBase<>& loc);
 
-/** A token that is lexed by the lexer. */
+/**
+ * A token that is lexed by the lexer.
+ * <p>
+ * The string type can be changed to e.g. a std::pmr::basic_string so
+ * that the contents of tokens are allocated from an Arena; see PmrTokenBase.
+ */
 template <typename _TChar   = char32_t,
     typename TokType        = TokenTypeBase,
-    typename SourceLocation = SourceLocationBase<>>
+    typename SourceLocation = SourceLocationBase<>,
+    typename _TString       = std::basic_string<_TChar>>
 struct TokenBase {
     using Type    = TokType;
     using TChar   = _TChar;
-    using TString = std::basic_string<TChar>;
-    static_assert(std::is_same_v<TString, typename SourceLocation::TFile::TString>,
+    using TString = _TString;
+    static_assert(std::is_same_v<TChar, typename SourceLocation::TFile::TChar>,
         "TChar of TokenBase must be the same as that of FileBase");
-    Type           type;           /// The type of this token
-    TString        string_content; /// The string content of the token
-    U64            number{};       /// The number that the token represents, if any
-    SourceLocation loc{};          /// Where the token was lexed
+    static_assert(std::is_same_v<TChar, typename TString::value_type>,
+        "TString of TokenBase must be a string of TChar");
+    Type           type;             /// The type of this token
+    TString        string_content;   /// The string content of the token
+    U64            number{};         /// The number that the token represents, if any
+    Symbol         symbol{NoSymbol}; /// The interned string content of identifiers, if any
+    SourceLocation loc{};            /// Where the token was lexed
 
     TokenBase(){};
 
+    /** Create a token whose string content is allocated using `alloc' */
+    explicit TokenBase(typename TString::allocator_type alloc) : string_content(alloc) {}
+
     bool operator==(const TokenBase& other) const {
-        return type == other.type && string_content == other.string_content && number == other.number;
+        if (type != other.type || number != other.number) return false;
+        if constexpr (requires { Type::Identifier; }) {
+            /// Only identifiers are interned; ignore the symbol of any other token.
+            if (type == Type::Identifier && symbol != NoSymbol && other.symbol != NoSymbol) return symbol == other.symbol;
+        }
+        return string_content == other.string_content;
     }
 
     /**
@@ -214,6 +233,12 @@ struct TokenBase {
     [[nodiscard]] virtual String Str() const = 0;
 };
 
+/** A token whose string content is allocated from a memory resource */
+template <typename TChar    = char32_t,
+    typename TokType        = TokenTypeBase,
+    typename SourceLocation = SourceLocationBase<>>
+using PmrTokenBase = TokenBase<TChar, TokType, SourceLocation, std::pmr::basic_string<TChar>>;
+
 #define IF32(_then, _else) [&] { if constexpr (is_32) return _then; else return _else; }()
 
 template <
@@ -238,6 +263,7 @@ struct LexerBase {
     SourceFile*             curr_file{};                          /// The file currently being processed
     bool                    newline_is_token = _newline_is_token; /// Whether newlines count as tokens
     bool                    has_error        = false;             /// Whether an error has occurred during lexing
+    Interner<TChar>*        interner{};                           /// If set, identifiers are interned using this
     static Token            global_empty_token;
 
     explicit LexerBase(const std::string& filename) {
@@ -278,50 +304,41 @@ struct LexerBase {
     int ToOctal(TChar c) { return c >= IF32(U'0', '0') && c <= IF32(U'7', '7') ? c - IF32(U'0', '0') : -1; }
     int ToDecimal(TChar c) { return c >= IF32(U'0', '0') && c <= IF32(U'9', '9') ? c - IF32(U'0', '0') : -1; }
     int ToHex(TChar c) {
-        if (c >= IF32(U'a', 'a') && c <= IF32(U'f', 'f')) return IF32(U'a', 'a');
-        if (c >= IF32(U'A', 'A') && c <= IF32(U'F', 'F')) return IF32(U'A', 'A');
-        ToDecimal(c);
+        if (c >= IF32(U'a', 'a') && c <= IF32(U'f', 'f')) return c - IF32(U'a', 'a') + 10;
+        if (c >= IF32(U'A', 'A') && c <= IF32(U'F', 'F')) return c - IF32(U'A', 'A') + 10;
+        return ToDecimal(c);
     }
 
+    /** Get the value of a digit, or -1 if `c' is not a digit in `base' */
+    template <U64 base>
+    int DigitValue(TChar c) {
+        if constexpr (base == 2) return ToBinary(c);
+        else if constexpr (base == 8) return ToOctal(c);
+        else if constexpr (base == 10) return ToDecimal(c);
+        else if constexpr (base == 16) return ToHex(c);
+        else ConstexprNotImplemented("DigitValue: Only implemented for 2, 8, 10, 16");
+    }
+
+    template <U64 base>
+    bool IsDigit(TChar c) { return DigitValue<base>(c) >= 0; }
+
     template <U64 base>
     std::function<int(TChar)> TCharToNumberForBase() {
-        if constexpr (base == 2) return ToBinary;
-        else if constexpr (base == 8) return ToOctal;
-        else if constexpr (base == 10) return ToDecimal;
-        else if constexpr (base == 16) return ToHex;
-        else ConstexprNotImplemented("NumberPredicateForBase: Only implemented for 2, 8, 10, 16");
+        return [this](TChar c) { return DigitValue<base>(c); };
     }
 
     /**
      * Perform the process of lexing a number
      *
-     * @param base The base of the number to be lexed
-     * @param predicate A predicate called on each character that
-     * determines whether it is allowed in that number or not
+     * @tparam base The base of the number to be lexed
      */
     template <U64 base>
     void DoLexNumber() {
-        /// Read all the digits into a buffer
-        TString number_str;
-        while (TCharToNumberForBase<base>()(lastc) >= 0) {
-            number_str += lastc;
-            NextChar();
-        }
-
-        /// Convert the string to a number
         U64 number = 0;
-        for (TChar *ptr = number_str.data(), *end = ptr + number_str.size(); ptr < end; ptr++) {
-            /// Multiply and check for overflow
-            U64 old_num = number;
-            number *= base;
-            if (old_num > number) LEXER_ERROR("Literal exceeds maximum integer size");
-
-            /// Add and check for overflow
-            old_num = number;
-            number += XDigitToNumber(*ptr);
-            if (old_num > number) LEXER_ERROR("Literal exceeds maximum integer size");
+        for (int digit; (digit = DigitValue<base>(lastc)) >= 0; NextChar()) {
+            if (number > (UINT64_MAX - U64(digit)) / base) LEXER_ERROR("Literal exceeds maximum integer size");
+            number = number * base + U64(digit);
         }
-
         token.number = number;
     }
 
@@ -340,6 +357,7 @@ struct LexerBase {
 
     /** Lex a number at the current position */
     void LexNumber() {
+        token.symbol = NoSymbol;
         /// If the number starts with a leading 0, it
         /// could be a binary, octal, or hexadecimal number
         if (lastc == L'0') {
@@ -360,22 +378,21 @@ struct LexerBase {
             /// It's binary
             if (lastc == L'b' || lastc == L'B') {
                 /// 0b alone is illegal
-                Char b = lastc;
+                TChar b = lastc;
                 NextChar();
-                if (!iswbdigit(wint_t(lastc)))
-                    LEXER_ERROR("Expected at least 1 digit after '0%lc'", b);
-                DoLexNumber(2, iswbdigit);
+                if (!IsDigit<2>(lastc)) LEXER_ERROR("Expected at least 1 digit after '0%lc'", b);
+                DoLexNumber<2>();
                 return;
             }
 
             /// It's octal
-            if (iswodigit(wint_t(lastc))) {
-                DoLexNumber(8, iswodigit);
+            if (IsDigit<8>(lastc)) {
+                DoLexNumber<8>();
                 return;
             }
 
             /// The number might be 0
-            if (!iscontinue(int(lastc)) || lastc == L'-') {
+            if (at_eof || !iscontinue(int(lastc)) || lastc == L'-') {
                 token.number = 0;
                 return;
             }
@@ -386,11 +403,29 @@ struct LexerBase {
 
         /// If the number doesn't start with a leading 0,
         /// it's a decimal number
-        DoLexNumber(10, iswdigit);
+        DoLexNumber<10>();
+    }
+
+    /**
+     * Lex an identifier at the current position
+     * <p>
+     * If an interner is set, the identifier is also interned and its
+     * symbol is stored in the token so that identifiers can be compared
+     * by symbol instead of by string content.
+     */
+    void LexIdentifier() {
+        token.type = T::Identifier;
+        token.string_content.clear();
+        do {
+            token.string_content += lastc;
+            NextChar();
+        } while (!at_eof && iscontinue(int(lastc)));
+        token.symbol = interner ? interner->Intern(token.string_content) : NoSymbol;
     }
 
     /** Lex a string literal at the current position */
     virtual void LexStringLiteral(bool yeet_terminator = true) {
+        token.symbol = NoSymbol;
         const Char term = lastc; /// " or '
         NextChar();              /// yeet " or '
         if (at_eof) goto unterminated;
@@ -468,7 +503,13 @@ struct LexerBase {
         lastc = c;
     }
 
-    /** Read the next token */
+    /**
+     * Read the next token
+     * <p>
+     * Implementations must reset `token.symbol' to NoSymbol for any token
+     * that is not lexed by LexIdentifier(); LexNumber() and
+     * LexStringLiteral() already do so.
+     */
     virtual void NextToken() = 0;
 
     /** Lex all tokens and print them */
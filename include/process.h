@@ -0,0 +1,443 @@
+#ifndef UTILS_PROCESS_H
+#define UTILS_PROCESS_H
+
+#include "./coroutine.h"
+#include "./file.h"
+#include "./utils.h"
+
+#include <condition_variable>
+#include <csignal>
+#include <functional>
+#include <mutex>
+#include <poll.h>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+#include <vector>
+
+/** How a process terminated */
+struct ExitStatus {
+    int code   = -1; /// The exit code, or -1 if the process was killed by a signal
+    int signal = 0;  /// The signal that killed the process, or 0 if it exited normally
+
+    /** Whether the process exited normally with exit code 0 */
+    [[nodiscard]] bool Success() const { return code == 0; }
+};
+
+/** How to start a process */
+struct ProcessOptions {
+    /// Environment variables, as `NAME=value', to set in addition to or
+    /// instead of ours, depending on `inherit_env'; a plain `NAME' removes
+    /// that variable.
+    std::vector<std::string> env;
+
+    /// The working directory of the child; empty to inherit ours.
+    std::string cwd;
+
+    /// Whether the child starts with our environment.
+    bool inherit_env = true;
+
+    /// Whether to close all file descriptors other than stdin, stdout, and
+    /// stderr in the child, including ones that aren't close-on-exec.
+    bool close_fds = true;
+};
+
+/**
+ * A child process whose stdin, stdout, and stderr are connected to pipes
+ * <p>
+ * Unlike SynchronousPipe, this does not wait for the child to exit before
+ * its output is read: Communicate() writes the input to the child's stdin
+ * while reading stdout and stderr as data becomes available, so a child
+ * can produce any amount of output without blocking on a full pipe.
+ */
+class Process {
+public:
+    /** Which pipe a piece of output came from */
+    enum struct Pipe : U8 {
+        Stdout,
+        Stderr,
+    };
+
+    /** A piece of output; the data is only valid until the next chunk is read */
+    struct Chunk {
+        Pipe             pipe{};
+        std::string_view data;
+    };
+
+    /** Called with each piece of output as it is read */
+    using OutputHandler = std::function<void(std::string_view)>;
+
+    /** Everything a process wrote, and how it terminated */
+    struct Result {
+        std::string out;
+        std::string err;
+        ExitStatus  status;
+    };
+
+    /** Everything a process wrote, mapped into memory, and how it terminated */
+    struct MappedResult {
+        MappedFile<> out;
+        MappedFile<> err;
+        ExitStatus   status;
+    };
+
+private:
+    friend class ProcessPool;
+    friend class Coprocess;
+
+    pid_t                     pid = -1;
+    FD                        in  = -1;
+    FD                        out = -1;
+    FD                        err = -1;
+    std::optional<ExitStatus> exit_status;
+    std::unique_ptr<char[]>   buffer;
+    _err_handler_t            err_handler;
+
+    /**
+     * Wait until the child's pipes are ready and service them once
+     * <p>
+     * Writes as much of `input' as the child accepts, closing its stdin once
+     * all of it has been written, and calls `handler' with whatever the child
+     * has written to stdout and stderr.
+     * @return Whether any of the pipes are still open
+     */
+    bool Poll(std::string_view& input, const std::function<void(Pipe, std::string_view)>& handler);
+
+    /**
+     * Get the pipes that Poll() would wait for
+     * @param fds Where to store them; must have room for three entries
+     * @return How many were stored
+     */
+    U64 PollFDs(std::string_view input, pollfd* fds);
+
+    /** The second half of Poll(), for pipes that have been waited for by the caller */
+    bool Service(const pollfd* fds, U64 n, std::string_view& input, const std::function<void(Pipe, std::string_view)>& handler);
+
+    void CloseInput();
+    void CloseAll();
+
+    /** Capture the output of a process started by Run() or RunShell() */
+    static Result Collect(Process proc, std::string_view input);
+
+public:
+    /**
+     * Start running a program
+     * <p>
+     * No shell is involved, so the arguments are passed to the program
+     * exactly as given.
+     * @param argv The program and its arguments; the program is looked
+     *        up in $PATH if it doesn't contain a '/'
+     * @param options How to start the program
+     */
+    explicit Process(const std::vector<std::string>& argv, const ProcessOptions& options = {}, _err_handler_t = _libutils_terminate);
+    Process(Process&& other) noexcept;
+    Process& operator=(Process&& other) noexcept;
+    Process(const Process&)            = delete;
+    Process& operator=(const Process&) = delete;
+
+    /**
+     * Close the pipes and wait for the child to exit if that hasn't happened yet
+     * <p>
+     * This blocks until the child exits. Most programs exit once their
+     * stdin is closed or they can no longer write their output, but one that
+     * ignores both blocks the destructor indefinitely; call Kill() first if
+     * the child may not exit on its own.
+     */
+    ~Process();
+
+    /** Whether the child was started successfully */
+    [[nodiscard]] bool Valid() const { return pid > 0; }
+
+    /** The process ID of the child */
+    [[nodiscard]] pid_t Pid() const { return pid; }
+
+    /**
+     * Feed the child its input and read all of its output
+     * <p>
+     * Returns once the child has closed its stdout and stderr, which
+     * usually means it has exited. The child's stdin is closed once all
+     * of the input has been written.
+     * @param input What to write to the child's stdin
+     * @param on_stdout Called with everything the child writes to stdout
+     * @param on_stderr Called with everything the child writes to stderr
+     */
+    void Communicate(std::string_view input, const OutputHandler& on_stdout, const OutputHandler& on_stderr);
+
+    /**
+     * Feed the child its input and iterate over its output
+     * <p>
+     * This is Communicate() as a generator; `input' must remain valid
+     * until the generator is exhausted.
+     */
+    [[nodiscard]] co_generator<Chunk> Output(std::string_view input = {});
+
+    /**
+     * Wait for the child to exit
+     * <p>
+     * This closes the pipes first, so output that hasn't been read yet is
+     * lost; call Communicate() first to read it.
+     */
+    ExitStatus Wait();
+
+    /** Send a signal to the child */
+    bool Kill(int signal = SIGTERM);
+
+    /**
+     * Start running a shell command
+     * <p>
+     * Starting bash takes a few milliseconds; prefer passing an argument
+     * vector to the constructor unless the command needs the shell.
+     * @param command The command to pass to `/bin/bash -c`
+     */
+    static Process Shell(const std::string& command, const ProcessOptions& options = {}, _err_handler_t = _libutils_terminate);
+
+    /**
+     * Run a program to completion and capture its output
+     * @param argv The program and its arguments
+     * @param input What to write to the program's stdin
+     */
+    static Result Run(
+        const std::vector<std::string>& argv,
+        std::string_view                input   = {},
+        const ProcessOptions&           options = {},
+        _err_handler_t                          = _libutils_terminate
+    );
+
+    /**
+     * Run a program to completion and capture its output in memory files
+     * <p>
+     * The program's stdin, stdout, and stderr are memory files rather than
+     * pipes, so it never has to wait for us to read its output, and the
+     * output is mapped into our address space instead of being copied.
+     * This is the fastest way to run programs that write a lot of output,
+     * but the output is only available once the program has exited.
+     * @param argv The program and its arguments
+     * @param input What to write to the program's stdin
+     * @return The output, or nothing if the program couldn't be run
+     */
+    static std::optional<MappedResult> RunMapped(
+        const std::vector<std::string>& argv,
+        std::string_view                input   = {},
+        const ProcessOptions&           options = {},
+        _err_handler_t                          = _libutils_terminate
+    );
+
+    /**
+     * Run a shell command to completion and capture its output
+     * @param command The command to pass to `/bin/bash -c`
+     * @param input What to write to the command's stdin
+     */
+    static Result RunShell(
+        const std::string&    command,
+        std::string_view      input   = {},
+        const ProcessOptions& options = {},
+        _err_handler_t                = _libutils_terminate
+    );
+};
+
+/**
+ * Runs many processes, a limited number at a time
+ * <p>
+ * Jobs are queued with Submit() and started by Run(), which keeps up to
+ * `max_parallel' of them running at once and services all of their pipes
+ * from a single poll() loop on the calling thread.
+ */
+class ProcessPool {
+public:
+    /** A program to run */
+    struct Job {
+        std::vector<std::string> argv;
+        std::string              input;
+        ProcessOptions           options;
+    };
+
+    /** Called with the index of a job, as returned by Submit(), and its result */
+    using CompletionHandler = std::function<void(U64, Process::Result&&)>;
+
+    /** In what order results are passed to the completion handler */
+    enum struct Order : U8 {
+        Completion, /// As soon as each job finishes
+        Submission, /// In the order in which the jobs were submitted
+    };
+
+private:
+    std::vector<Job> jobs;
+    U64              max_parallel;
+    _err_handler_t   err_handler;
+
+public:
+    /**
+     * Create a pool
+     * @param max_parallel How many processes to run at once; 0 means one per CPU
+     */
+    explicit ProcessPool(U64 max_parallel = 0, _err_handler_t = _libutils_terminate);
+
+    /**
+     * Queue a job
+     * @return The index of the job, which identifies its result
+     */
+    U64 Submit(Job job);
+
+    /** Queue a shell command; see Process::Shell() */
+    U64 SubmitShell(const std::string& command, std::string input = {}, ProcessOptions options = {});
+
+    /** The number of jobs that have been submitted but not run */
+    [[nodiscard]] U64 Pending() const { return jobs.size(); }
+
+    /**
+     * Run all queued jobs
+     * <p>
+     * Indices restart at 0 for jobs submitted afterwards.
+     * @param on_complete Called with the result of each job
+     * @param order The order in which `on_complete' is called
+     */
+    void Run(const CompletionHandler& on_complete, Order order = Order::Completion);
+
+    /**
+     * Run all queued jobs
+     * @return The results, in submission order
+     */
+    std::vector<Process::Result> Run();
+};
+
+/**
+ * Run programs in parallel and capture their output
+ * @param commands The argument vectors of the programs to run
+ * @param max_parallel How many processes to run at once; 0 means one per CPU
+ * @return The results, in the same order as `commands'
+ */
+std::vector<Process::Result> RunAll(const std::vector<std::vector<std::string>>& commands, U64 max_parallel = 0, _err_handler_t = _libutils_terminate);
+
+/**
+ * A long-lived child process that answers requests
+ * <p>
+ * Requests are written to the child's stdin and each is answered by one
+ * response on its stdout, so issuing a request costs a round trip through
+ * a pipe rather than starting a new process. Whatever the child writes to
+ * stderr is kept around for diagnostics.
+ * <p>
+ * If the child exits or closes its pipes, it is restarted and the request
+ * is retried once.
+ */
+class Coprocess {
+public:
+    /** How requests and responses are delimited */
+    enum struct Framing : U8 {
+        Line,   /// Each message is terminated by a newline
+        Length, /// Each message is preceded by its length as a 32-bit little-endian integer
+    };
+
+private:
+    std::vector<std::string> argv;
+    ProcessOptions           options;
+    Framing                  framing;
+    Process                  proc;
+    std::string              read_buffer;
+    U64                      read_start = 0; /// Start of the data that hasn't been parsed yet
+    U64                      read_scan  = 0; /// Where to continue looking for a newline
+    U64                      read_end   = 0; /// End of the data in the buffer
+    std::string              write_buffer;
+    std::string              stderr_tail;
+    U64                      restarts = 0;
+    _err_handler_t           err_handler;
+
+    /** Send a request and wait for the response; returns false if the child went away */
+    bool Exchange(std::string_view request, std::string_view& response);
+
+    /** Try to extract a complete response from the read buffer */
+    bool ParseResponse(std::string_view& response);
+
+public:
+    /**
+     * Start a coprocess
+     * @param argv The program and its arguments
+     * @param framing How requests and responses are delimited
+     * @param options How to start the program
+     */
+    explicit Coprocess(
+        std::vector<std::string> argv,
+        Framing                  framing = Framing::Line,
+        ProcessOptions           options = {},
+        _err_handler_t                   = _libutils_terminate
+    );
+
+    /**
+     * Send a request and wait for the response
+     * <p>
+     * In line mode, a newline is appended to the request if it doesn't
+     * end with one, and the response is returned without its newline.
+     * @return The response, which is valid until the next request, or
+     *         nothing if the child couldn't be (re)started or kept dying
+     */
+    std::optional<std::string_view> Request(std::string_view request);
+
+    /** Kill the child and start a new one */
+    void Restart();
+
+    /** How many times the child has been restarted */
+    [[nodiscard]] U64 Restarts() const { return restarts; }
+
+    /** The last 64 KiB the child wrote to stderr */
+    [[nodiscard]] std::string_view Stderr() const { return stderr_tail; }
+
+    /** The process ID of the child */
+    [[nodiscard]] pid_t Pid() const { return proc.Pid(); }
+};
+
+/**
+ * A fixed set of identical coprocesses that can be shared between threads
+ * <p>
+ * Each coprocess serves one request at a time; threads that want to send a
+ * request while all of them are busy wait until one becomes available.
+ */
+class CoprocessPool {
+    std::vector<std::unique_ptr<Coprocess>> coprocesses;
+    std::vector<Coprocess*>                 idle;
+    std::mutex                              mutex;
+    std::condition_variable                 available;
+
+    void Release(Coprocess* co);
+
+public:
+    /** Exclusive use of a coprocess, which is returned to the pool on destruction */
+    class Lease {
+        friend CoprocessPool;
+        CoprocessPool* pool{};
+        Coprocess*     co{};
+        Lease(CoprocessPool* _pool, Coprocess* _co) : pool(_pool), co(_co) {}
+
+    public:
+        Lease(Lease&& other) noexcept : pool(std::exchange(other.pool, nullptr)), co(std::exchange(other.co, nullptr)) {}
+        Lease& operator=(Lease&&) = delete;
+        ~Lease() {
+            if (co) pool->Release(co);
+        }
+
+        Coprocess& operator*() const { return *co; }
+        Coprocess* operator->() const { return co; }
+    };
+
+    /**
+     * Start the coprocesses
+     * @param size How many coprocesses to start; 0 means one per CPU
+     * @see Coprocess::Coprocess()
+     */
+    CoprocessPool(
+        U64                      size,
+        std::vector<std::string> argv,
+        Coprocess::Framing       framing = Coprocess::Framing::Line,
+        ProcessOptions           options = {},
+        _err_handler_t                   = _libutils_terminate
+    );
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(CoprocessPool);
+
+    /** Wait until a coprocess is idle and take it */
+    Lease Acquire();
+
+    /** Send a request to an idle coprocess; see Coprocess::Request() */
+    std::optional<std::string> Request(std::string_view request);
+};
+
+#endif // UTILS_PROCESS_H
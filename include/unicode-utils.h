@@ -11,6 +11,32 @@ LIBUTILS_NAMESPACE_BEGIN
 unsigned char isstart(int c);
 unsigned char iscontinue(int c);
 
+/** Map a character to lowercase using its simple lowercase mapping */
+Char ToLowerChar(Char c);
+
+/** Map a character to uppercase using its simple uppercase mapping */
+Char ToUpperChar(Char c);
+
+/** Map a character using its simple case folding */
+Char CaseFoldChar(Char c);
+
+/**
+ * Compare two strings case-insensitively
+ * <p>
+ * Characters are compared after simple case folding, which makes this
+ * suitable for matching identifiers.
+ * @return Whether the strings are equal when case is ignored
+ */
+bool EqualsIgnoreCase(std::u32string_view a, std::u32string_view b);
+
+/**
+ * Compare two strings case-insensitively
+ * <p>
+ * Only ASCII letters are folded.
+ * @return Whether the strings are equal when case is ignored
+ */
+bool EqualsIgnoreCase(std::string_view a, std::string_view b);
+
 LIBUTILS_NAMESPACE_END
 
 #endif // UTILS_UNICODE_UTILS_H
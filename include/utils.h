@@ -1,12 +1,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
-#include <codecvt>
+#include <algorithm>
+#include <array>
 #include <cstdlib>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <locale>
+#include <memory_resource>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
 #ifdef NDEBUG
 #    define DEBUG(...)
@@ -85,20 +92,93 @@ String Escape(const String& str);
  */
 std::string Escape(const std::string& str);
 
+/** Escape a string
+ *  @param str the string to be escaped
+ *  @param resource the memory resource that the result is allocated from
+ *  @returns a new string containing the escaped contents of `str`
+ */
+std::pmr::u32string Escape(std::u32string_view str, std::pmr::memory_resource* resource);
+
+/** Escape a string
+ *  @param str the string to be escaped
+ *  @param resource the memory resource that the result is allocated from
+ *  @returns a new string containing the escaped contents of `str`
+ */
+std::pmr::string Escape(std::string_view str, std::pmr::memory_resource* resource);
+
+/** How malformed input is handled when converting between UTF-8 and UTF-32 */
+enum struct UTFErrorMode {
+    /** Throw a std::range_error */
+    Throw,
+
+    /** Replace every maximal ill-formed subsequence with U+FFFD */
+    Replace,
+};
+
+/**
+ * Convert UTF-32 to UTF-8
+ * <p>
+ * Surrogates and values above U+10FFFF are considered invalid.
+ * @param what The UTF-32 string to be converted
+ * @param mode What to do if `what' contains invalid code points
+ * @return A new std::string containing the contents of `what' as a UTF-8 string
+ * @throw std::range_error if `what' is invalid and `mode' is UTFErrorMode::Throw
+ */
+std::string UTF32ToUTF8(std::u32string_view what, UTFErrorMode mode = UTFErrorMode::Throw);
+
+/** Like UTF32ToUTF8(), but allocate the result from `resource' */
+std::pmr::string UTF32ToUTF8(std::u32string_view what, std::pmr::memory_resource* resource, UTFErrorMode mode = UTFErrorMode::Throw);
+
+/**
+ * Convert UTF-8 to UTF-32
+ * <p>
+ * Overlong encodings, encoded surrogates, code points above U+10FFFF, and
+ * truncated sequences are considered invalid.
+ * @param what The UTF-8 string to be converted
+ * @param mode What to do if `what' is not valid UTF-8
+ * @return A new String containing the contents of `what' as a UTF-32 string
+ * @throw std::range_error if `what' is invalid and `mode' is UTFErrorMode::Throw
+ */
+String UTF8ToUTF32(std::string_view what, UTFErrorMode mode = UTFErrorMode::Throw);
+
+/** Like UTF8ToUTF32(), but allocate the result from `resource' */
+std::pmr::u32string UTF8ToUTF32(std::string_view what, std::pmr::memory_resource* resource, UTFErrorMode mode = UTFErrorMode::Throw);
+
+/** The result of validating a UTF-8 string */
+struct UTF8ValidationResult {
+    /** Whether the input is valid UTF-8 */
+    bool ok;
+
+    /** The offset of the first ill-formed sequence, or the input size if `ok' is true */
+    U64 error_offset;
+
+    explicit operator bool() const { return ok; }
+};
+
+/**
+ * Check whether a string is valid UTF-8
+ * <p>
+ * This uses the same definition of validity as UTF8ToUTF32(), but does not
+ * allocate. Blocks of 16 or 32 bytes are validated at once if the CPU
+ * supports SSSE3 or AVX2, respectively.
+ * @param what The string to validate
+ * @return Whether `what' is valid, and if not, where the first error is
+ */
+UTF8ValidationResult ValidateUTF8(std::string_view what);
+
 /**
  * Convert UTF-32 to UTF-8
  *
  * @tparam TString The string type
  * @param what The UTF-32 string to be converted
+ * @param mode What to do if `what' contains invalid code points
  * @return A new std::string containing the contents of `what' as a UTF-8 string
  */
 template <typename TString>
-std::string ToUTF8(const TString& what) {
-    if constexpr (std::is_convertible_v<TString, std::string>) return what;
-    else if constexpr (std::is_convertible_v<TString, std::u32string>) {
-        std::wstring_convert<std::codecvt_utf8<Char>, Char> conv;
-        return conv.to_bytes(what);
-    } else ConstexprNotImplemented("ToUTF8 currently only supports u8 and u32 strings");
+std::string ToUTF8(const TString& what, UTFErrorMode mode = UTFErrorMode::Throw) {
+    if constexpr (std::is_convertible_v<const TString&, std::string_view>) return std::string(std::string_view(what));
+    else if constexpr (std::is_convertible_v<const TString&, std::u32string_view>) return UTF32ToUTF8(what, mode);
+    else ConstexprNotImplemented("ToUTF8 currently only supports u8 and u32 strings");
 }
 
 /**
@@ -106,17 +186,203 @@ std::string ToUTF8(const TString& what) {
  *
  * @tparam TString The string type
  * @param what The UTF-8 string to be converted
+ * @param mode What to do if `what' is not valid UTF-8
  * @return A new std::string containing the contents of `what' as a UTF-32 string
  */
 template <typename TString>
-String ToUTF32(const TString& what) {
-    if constexpr (std::is_convertible_v<TString, std::string>) {
-        std::wstring_convert<std::codecvt_utf8<Char>, Char> conv;
-        return conv.from_bytes(what);
-    } else if constexpr (std::is_convertible_v<TString, std::u32string>) return what;
+String ToUTF32(const TString& what, UTFErrorMode mode = UTFErrorMode::Throw) {
+    if constexpr (std::is_convertible_v<const TString&, std::string_view>) return UTF8ToUTF32(what, mode);
+    else if constexpr (std::is_convertible_v<const TString&, std::u32string_view>) return String(std::u32string_view(what));
     else ConstexprNotImplemented("ToUTF32 currently only supports u8 and u32 strings");
 }
 
+/**
+ * Find a short needle in a haystack using SIMD
+ * <p>
+ * Used by Searcher; call Searcher::Find() instead.
+ * @return The offset of the first occurrence, or U64(-1) if there is none
+ */
+U64 _libutils_find_short(const char* haystack, U64 n, const char* needle, U64 m);
+U64 _libutils_find_short(const Char* haystack, U64 n, const Char* needle, U64 m);
+
+/**
+ * A precompiled substring search
+ * <p>
+ * Construct this once for a needle and reuse it to search any number of
+ * haystacks. Short needles of `char' or `Char' are found by comparing the
+ * first and last character of the needle against a block of positions at
+ * once, and only verifying the positions where both match. All other
+ * needles use the Two-Way algorithm, which runs in linear time and
+ * constant space.
+ * @tparam TChar The character type
+ */
+template <typename TChar>
+class Searcher {
+    using View = std::basic_string_view<TChar>;
+
+    /// Needles up to this length use the SIMD filter, if there is one for this character type.
+    static constexpr U64  ShortNeedle    = 32;
+    static constexpr bool HasShortSearch = std::is_same_v<TChar, char> || std::is_same_v<TChar, Char>;
+
+    std::basic_string<TChar> needle;
+    I64                      critical_pos{}; /// Last index of the left half of the critical factorisation
+    U64                      period{};       /// The period of the needle, or a lower bound if not periodic
+    bool                     periodic{};     /// Whether the needle is periodic
+
+    /// Compute the maximal suffix of the needle w.r.t. < or >.
+    I64 MaximalSuffix(U64& p, bool reverse) const {
+        const U64 m  = needle.size();
+        I64       ms = -1;
+        U64       j = 0, k = 1;
+        p           = 1;
+        while (j + k < m) {
+            const TChar a = needle[j + k];
+            const TChar b = needle[U64(ms + I64(k))];
+            if (reverse ? a > b : a < b) {
+                j += k;
+                k = 1;
+                p = U64(I64(j) - ms);
+            } else if (a == b) {
+                if (k != p) k++;
+                else {
+                    j += p;
+                    k = 1;
+                }
+            } else {
+                ms = I64(j);
+                j  = U64(ms) + 1;
+                k = p = 1;
+            }
+        }
+        return ms;
+    }
+
+    U64 TwoWay(const TChar* hay, U64 n) const {
+        const TChar* x = needle.data();
+        const I64    m = I64(needle.size());
+        const I64    l = critical_pos;
+        I64          j = 0;
+        if (periodic) {
+            /// Remember how much of the needle we already know matches
+            /// after shifting by the period.
+            I64 memory = -1;
+            while (j <= I64(n) - m) {
+                I64 i = std::max(l, memory) + 1;
+                while (i < m && x[i] == hay[i + j]) i++;
+                if (i >= m) {
+                    i = l;
+                    while (i > memory && x[i] == hay[i + j]) i--;
+                    if (i <= memory) return U64(j);
+                    j += I64(period);
+                    memory = m - I64(period) - 1;
+                } else {
+                    j += i - l;
+                    memory = -1;
+                }
+            }
+        } else {
+            while (j <= I64(n) - m) {
+                I64 i = l + 1;
+                while (i < m && x[i] == hay[i + j]) i++;
+                if (i >= m) {
+                    i = l;
+                    while (i >= 0 && x[i] == hay[i + j]) i--;
+                    if (i < 0) return U64(j);
+                    j += I64(period);
+                } else j += i - l;
+            }
+        }
+        return npos;
+    }
+
+public:
+    static constexpr U64 npos = U64(-1);
+
+    /**
+     * Precompile a search for a needle
+     * @param _needle The string to search for
+     */
+    explicit Searcher(View _needle) : needle(_needle) {
+        if (HasShortSearch && needle.size() <= ShortNeedle) return;
+
+        /// Compute the critical factorisation of the needle.
+        U64       p, q;
+        const I64 i = MaximalSuffix(p, false);
+        const I64 j = MaximalSuffix(q, true);
+        critical_pos = std::max(i, j);
+        period       = i > j ? p : q;
+
+        const U64 left = U64(critical_pos + 1);
+        periodic       = period + left <= needle.size() && std::char_traits<TChar>::compare(needle.data(), needle.data() + period, left) == 0;
+        if (!periodic) period = std::max(left, needle.size() - left) + 1;
+    }
+
+    /** The length of the needle */
+    [[nodiscard]] U64 size() const { return needle.size(); }
+
+    /**
+     * Find the first occurrence of the needle in a haystack
+     * @param haystack The string to search
+     * @param from The position at which to start searching
+     * @return The position of the first occurrence at or after `from', or npos if there is none
+     */
+    [[nodiscard]] U64 Find(View haystack, U64 from = 0) const {
+        if (from > haystack.size()) return npos;
+        const TChar* hay = haystack.data() + from;
+        const U64    n   = haystack.size() - from;
+        const U64    m   = needle.size();
+        if (m == 0) return from;
+        if (m > n) return npos;
+
+        U64 pos;
+        if constexpr (HasShortSearch) {
+            if (m <= ShortNeedle) pos = _libutils_find_short(hay, n, needle.data(), m);
+            else pos = TwoWay(hay, n);
+        } else {
+            pos = TwoWay(hay, n);
+        }
+        return pos == npos ? npos : pos + from;
+    }
+};
+
+/// Implementation of ReplaceAllCopy() once the first occurrence has been found.
+template <typename TString>
+TString _libutils_replace_all(const TString& str, const Searcher<typename TString::value_type>& searcher, U64 pos, const TString& to) {
+    /// Build the result in a single pass instead of shifting the tail of
+    /// the string around for every occurrence.
+    TString out;
+    out.reserve(str.size());
+    U64 where = 0;
+    do {
+        out.append(str, where, pos - where);
+        out.append(to);
+        where = pos + searcher.size();
+        pos   = searcher.Find(str, where);
+    } while (pos != TString::npos);
+    out.append(str, where);
+    return out;
+}
+
+/**
+ * Replace all occurrences of one string with another string
+ * <p>
+ * Occurrences are replaced from left to right and do not overlap; text
+ * that was inserted as a replacement is never searched again.
+ * @tparam TString The string type
+ * @param str The string in which to replace
+ * @param from The string to replace
+ * @param to The replacement string
+ * @return A copy of `str' with all occurrences of `from' replaced with `to'
+ */
+template <typename TString>
+TString ReplaceAllCopy(const TString& str, const TString& from, const TString& to) {
+    if (from.empty()) return str;
+    const Searcher<typename TString::value_type> searcher{from};
+    const U64                                    pos = searcher.Find(str);
+    if (pos == TString::npos) return str;
+    return _libutils_replace_all(str, searcher, pos, to);
+}
+
 /**
  * Replace all occurrences of one string with another string
  * @tparam TString The string type
@@ -126,15 +392,206 @@ String ToUTF32(const TString& what) {
  */
 template <typename TString>
 void ReplaceAll(TString& str, const TString& from, const TString& to) {
-    const U64 to_len   = to.size();
-    const U64 from_len = from.size();
-    U64       where    = 0;
-    for (;;) {
-        auto pos = str.find(from, where);
-        if (pos == TString::npos) return;
-        str.replace(pos, from_len, to);
-        where = pos + to_len;
+    if (from.empty()) return;
+    const Searcher<typename TString::value_type> searcher{from};
+    const U64                                    pos = searcher.Find(str);
+    if (pos == TString::npos) return;
+    str = _libutils_replace_all(str, searcher, pos, to);
+}
+
+/**
+ * Replaces several strings at once
+ * <p>
+ * This builds an Aho-Corasick automaton from the strings to be replaced
+ * so that any number of them can be replaced in a single scan. Build the
+ * replacer once and reuse it if you need to apply the same replacements
+ * to several strings.
+ * <p>
+ * Occurrences are replaced from left to right and do not overlap. If
+ * several patterns match at the same position, the longest one wins.
+ * Empty patterns are ignored, as are duplicates of an earlier pattern.
+ * @tparam TString The string type
+ */
+template <typename TString>
+class MultiReplacer {
+    using TChar = typename TString::value_type;
+    using View  = std::basic_string_view<TChar>;
+
+    static constexpr U32 NoMatch = U32(-1);
+
+    struct State {
+        U64 depth{};          /// Length of the prefix that this state represents
+        U32 match = NoMatch;  /// Longest pattern that is a suffix of that prefix
+    };
+
+    /// Classes of wide characters. Those in the BMP are looked up in a flat
+    /// table that extends up to the largest one that occurs in a pattern;
+    /// only characters outside the BMP need a hash lookup, and only if one
+    /// of them occurs in a pattern.
+    struct WideClassMap {
+        std::vector<U32>               bmp;
+        std::unordered_map<TChar, U32> rest;
+    };
+
+    /// Characters that occur in no pattern all map to class 0.
+    using ClassMap = std::conditional_t<sizeof(TChar) == 1, std::array<U32, 256>, WideClassMap>;
+
+    std::vector<std::pair<TString, TString>> replacements;
+    std::vector<State>                       states;
+    std::vector<U32>                         transitions; /// states.size() * n_classes entries
+    ClassMap                                 classes{};
+    U32                                      n_classes = 1;
+
+    U32 Class(TChar c) const {
+        if constexpr (sizeof(TChar) == 1) return classes[U8(c)];
+        else {
+            const U64 u = std::make_unsigned_t<TChar>(c);
+            if (u < classes.bmp.size()) return classes.bmp[u];
+            if (u <= 0xFFFF || classes.rest.empty()) return 0;
+            auto it = classes.rest.find(c);
+            return it == classes.rest.end() ? 0 : it->second;
+        }
+    }
+
+    U32& Transition(U32 state, U32 cls) { return transitions[U64(state) * n_classes + cls]; }
+    U32  Transition(U32 state, U32 cls) const { return transitions[U64(state) * n_classes + cls]; }
+
+public:
+    /**
+     * Build a replacer
+     * @param _replacements A list of (from, to) pairs
+     */
+    explicit MultiReplacer(std::vector<std::pair<TString, TString>> _replacements)
+        : replacements(std::move(_replacements)) {
+        /// Assign a class to every character that occurs in a pattern.
+        for (const auto& [from, _] : replacements) {
+            for (TChar c : from) {
+                if constexpr (sizeof(TChar) == 1) {
+                    if (!classes[U8(c)]) classes[U8(c)] = n_classes++;
+                } else if (const U64 u = std::make_unsigned_t<TChar>(c); u <= 0xFFFF) {
+                    if (u >= classes.bmp.size()) classes.bmp.resize(u + 1, 0);
+                    if (!classes.bmp[u]) classes.bmp[u] = n_classes++;
+                } else if (classes.rest.try_emplace(c, n_classes).second) n_classes++;
+            }
+        }
+
+        /// Build the trie. NoMatch doubles as `no transition' for now.
+        states.emplace_back();
+        transitions.assign(n_classes, NoMatch);
+        for (U32 i = 0; i < replacements.size(); i++) {
+            const auto& from = replacements[i].first;
+            if (from.empty()) continue;
+            U32 state = 0;
+            for (TChar c : from) {
+                U32 next = Transition(state, Class(c));
+                if (next == NoMatch) {
+                    next = U32(states.size());
+                    states.push_back({states[state].depth + 1, NoMatch});
+                    transitions.resize(transitions.size() + n_classes, NoMatch);
+                    Transition(state, Class(c)) = next;
+                }
+                state = next;
+            }
+            if (states[state].match == NoMatch) states[state].match = i;
+        }
+
+        /// Turn the trie into a DFA by filling in the missing transitions
+        /// from the failure links, in breadth-first order.
+        std::vector<U32> fail(states.size(), 0);
+        std::vector<U32> queue;
+        queue.reserve(states.size());
+        for (U32 c = 0; c < n_classes; c++) {
+            U32& next = Transition(0, c);
+            if (next == NoMatch) next = 0;
+            else queue.push_back(next);
+        }
+        for (U64 q = 0; q < queue.size(); q++) {
+            const U32 state = queue[q];
+
+            /// A state's failure link is shallower, and therefore already complete.
+            if (states[state].match == NoMatch) states[state].match = states[fail[state]].match;
+            for (U32 c = 0; c < n_classes; c++) {
+                U32& next = Transition(state, c);
+                if (next == NoMatch) next = Transition(fail[state], c);
+                else {
+                    fail[next] = Transition(fail[state], c);
+                    queue.push_back(next);
+                }
+            }
+        }
     }
+
+    /**
+     * Perform all replacements
+     * @param str The string in which to replace
+     * @return A copy of `str' with all replacements applied
+     */
+    TString Replace(View str) const {
+        TString out;
+        out.reserve(str.size());
+
+        const U64 n      = str.size();
+        U64       copied = 0; /// Everything before this has been written to `out'
+        U64       i      = 0;
+        for (;;) {
+            /// Find the leftmost-longest match starting at or after `i'.
+            U32  state = 0;
+            bool found = false;
+            U64  start = 0, len = 0;
+            U32  pattern = NoMatch;
+            for (; i < n; i++) {
+                state          = Transition(state, Class(str[i]));
+                const auto& st = states[state];
+                if (st.match != NoMatch) {
+                    const U64 m_len   = replacements[st.match].first.size();
+                    const U64 m_start = i + 1 - m_len;
+                    if (!found || m_start < start || (m_start == start && m_len > len)) {
+                        found   = true;
+                        start   = m_start;
+                        len     = m_len;
+                        pattern = st.match;
+                    }
+                }
+
+                /// No match that is still in progress can start at or
+                /// before the one we've found, so it's final.
+                if (found && i + 1 - st.depth > start) break;
+            }
+            if (!found) break;
+
+            out.append(str.substr(copied, start - copied));
+            out.append(replacements[pattern].second);
+            copied = i = start + len;
+        }
+
+        out.append(str.substr(copied));
+        return out;
+    }
+};
+
+/**
+ * Replace all occurrences of several strings at once
+ * @tparam TString The string type
+ * @param str The string in which to replace
+ * @param replacements A list of (from, to) pairs
+ * @return A copy of `str' with all replacements applied
+ * @see MultiReplacer
+ */
+template <typename TString>
+TString ReplaceAllCopy(const TString& str, std::vector<std::pair<TString, TString>> replacements) {
+    return MultiReplacer<TString>(std::move(replacements)).Replace(str);
+}
+
+/**
+ * Replace all occurrences of several strings at once
+ * @tparam TString The string type
+ * @param str The string in which to replace
+ * @param replacements A list of (from, to) pairs
+ * @see MultiReplacer
+ */
+template <typename TString>
+void ReplaceAll(TString& str, std::vector<std::pair<TString, TString>> replacements) {
+    str = ReplaceAllCopy(str, std::move(replacements));
 }
 
 /// Base template
@@ -165,6 +622,64 @@ using type_if_t = typename type_if<cond, _Then, _Else>::type;
 
 /**
  * Convert a string to lowercase
+ * <p>
+ * Only ASCII letters are converted; this does not depend on the locale.
+ * @param str The string to convert
+ * @returns A copy of `str' with each character converted to lowercase
+ */
+std::string ToLower(std::string str);
+
+/**
+ * Convert a string to lowercase
+ * <p>
+ * This uses the simple lowercase mapping of the Unicode Character Database.
+ * @param str The string to convert
+ * @returns A copy of `str' with each character converted to lowercase
+ */
+String ToLower(String str);
+
+/**
+ * Convert a string to uppercase
+ * <p>
+ * Only ASCII letters are converted; this does not depend on the locale.
+ * @param str The string to convert
+ * @returns A copy of `str' with each character converted to uppercase
+ */
+std::string ToUpper(std::string str);
+
+/**
+ * Convert a string to uppercase
+ * <p>
+ * This uses the simple uppercase mapping of the Unicode Character Database.
+ * @param str The string to convert
+ * @returns A copy of `str' with each character converted to uppercase
+ */
+String ToUpper(String str);
+
+/**
+ * Case-fold a string
+ * <p>
+ * Only ASCII letters are folded; this does not depend on the locale.
+ * @param str The string to fold
+ * @returns A copy of `str' that can be compared case-insensitively
+ */
+std::string CaseFold(std::string str);
+
+/**
+ * Case-fold a string
+ * <p>
+ * This uses the simple case folding of the Unicode Character Database, so
+ * the result has the same length as `str'.
+ * @param str The string to fold
+ * @returns A copy of `str' that can be compared case-insensitively
+ */
+String CaseFold(String str);
+
+/**
+ * Convert a string to lowercase
+ * <p>
+ * This is the fallback for string types other than std::string and String
+ * and converts each character using std::tolower().
  * @tparam TString The string type to be used
  * @param tstring The string to convert
  * @returns A copy of `tstring' with each character converted to lowercase
@@ -181,18 +696,211 @@ TString ToUpper(TString tstring) {
     return tstring;
 }
 
+/**
+ * Scanning primitives used by TrimView(), Split(), SplitLines(), and Tokenize()
+ * <p>
+ * These return the index of the first character that is equal to `c', or
+ * that is (or is not) whitespace, or `n' if there is no such character.
+ * Whitespace is ASCII whitespace for char; for Char, it is the Unicode
+ * White_Space property.
+ */
+U64 _libutils_find_char(const char* data, U64 n, char c);
+U64 _libutils_find_char(const Char* data, U64 n, Char c);
+U64 _libutils_find_space(const char* data, U64 n);
+U64 _libutils_find_space(const Char* data, U64 n);
+U64 _libutils_find_non_space(const char* data, U64 n);
+U64 _libutils_find_non_space(const Char* data, U64 n);
+bool _libutils_is_space(Char c);
+
+/// Only ASCII whitespace; other bytes may be part of a multibyte character.
+inline bool _libutils_is_space(char c) { return (c >= 9 && c <= 13) || c == ' '; }
+
+/**
+ * Trim leading and trailing whitespace without copying
+ * @param str The string to trim
+ * @returns A view of `str' with leading and trailing whitespace removed
+ */
+template <typename TChar>
+std::basic_string_view<TChar> _libutils_trim_view(std::basic_string_view<TChar> str) {
+    const U64 start = _libutils_find_non_space(str.data(), str.size());
+    U64       end   = str.size();
+    while (end > start && _libutils_is_space(str[end - 1])) end--;
+    return str.substr(start, end - start);
+}
+
+inline std::string_view    TrimView(std::string_view str) { return _libutils_trim_view(str); }
+inline std::u32string_view TrimView(std::u32string_view str) { return _libutils_trim_view(str); }
+
+/**
+ * A lazy range of views into a string
+ * <p>
+ * This is the return type of Split(), SplitLines(), and Tokenize(). Pieces
+ * are computed as the range is iterated and are views into the original
+ * string, so nothing is allocated, but the string must outlive the range.
+ * @tparam TChar The character type
+ */
+template <typename TChar>
+class SplitRange {
+public:
+    using View = std::basic_string_view<TChar>;
+
+    /** How the string is split */
+    enum struct Mode {
+        /** Split at every occurrence of a delimiter; empty pieces are kept */
+        Delimiter,
+
+        /** Split at line breaks, i.e. "\n" and "\r\n"; a final line break does not start another line */
+        Lines,
+
+        /** Split at runs of whitespace; empty pieces are discarded */
+        Whitespace,
+    };
+
+    struct iterator {
+        using value_type       = View;
+        using difference_type  = std::ptrdiff_t;
+        using iterator_concept = std::forward_iterator_tag;
+
+        View piece{};       /// The current piece
+        View rest{};        /// Everything after the current piece
+        Mode mode{};        /// How to split `rest'
+        TChar delimiter{};  /// The delimiter, if mode is Delimiter
+        bool done = true;   /// Whether we're past the last piece
+        bool last = false;  /// Whether `piece' is the last piece in Delimiter mode
+
+        View operator*() const { return piece; }
+        const View* operator->() const { return &piece; }
+
+        iterator& operator++() {
+            switch (mode) {
+                case Mode::Delimiter: {
+                    if (last) {
+                        done = true;
+                        return *this;
+                    }
+                    const U64 pos = _libutils_find_char(rest.data(), rest.size(), delimiter);
+                    piece         = rest.substr(0, pos);
+                    last          = pos == rest.size();
+                    rest          = last ? View{} : rest.substr(pos + 1);
+                    return *this;
+                }
+
+                case Mode::Lines: {
+                    if (rest.empty()) {
+                        done = true;
+                        return *this;
+                    }
+                    const U64  pos        = _libutils_find_char(rest.data(), rest.size(), TChar('\n'));
+                    const bool terminated = pos != rest.size();
+                    piece                 = rest.substr(0, pos);
+                    rest                  = terminated ? rest.substr(pos + 1) : View{};
+                    if (terminated && !piece.empty() && piece.back() == TChar('\r')) piece.remove_suffix(1);
+                    return *this;
+                }
+
+                case Mode::Whitespace: {
+                    const U64 start = _libutils_find_non_space(rest.data(), rest.size());
+                    if (start == rest.size()) {
+                        done = true;
+                        return *this;
+                    }
+                    rest          = rest.substr(start);
+                    const U64 end = _libutils_find_space(rest.data(), rest.size());
+                    piece         = rest.substr(0, end);
+                    rest          = rest.substr(end);
+                    return *this;
+                }
+            }
+            LIBUTILS_UNREACHABLE();
+        }
+
+        iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        bool operator==(std::default_sentinel_t) const { return done; }
+        bool operator==(const iterator& other) const {
+            return done == other.done && (done || (piece.data() == other.piece.data() && piece.size() == other.piece.size()));
+        }
+    };
+
+private:
+    View  str;
+    Mode  mode;
+    TChar delimiter;
+
+public:
+    SplitRange(View _str, Mode _mode, TChar _delimiter = {})
+        : str(_str), mode(_mode), delimiter(_delimiter) {}
+
+    [[nodiscard]] iterator begin() const {
+        iterator it{{}, str, mode, delimiter, false, false};
+        return ++it;
+    }
+
+    [[nodiscard]] std::default_sentinel_t end() const { return {}; }
+};
+
+/**
+ * Split a string at every occurrence of a delimiter
+ * <p>
+ * Empty pieces are kept, so splitting "a,,b" at ',' yields "a", "", and
+ * "b", and splitting an empty string yields a single empty piece.
+ * @param str The string to split; must outlive the result
+ * @param delimiter The character to split at
+ * @returns A lazy range of views into `str'
+ */
+inline SplitRange<char> Split(std::string_view str, char delimiter) {
+    return {str, SplitRange<char>::Mode::Delimiter, delimiter};
+}
+
+inline SplitRange<Char> Split(std::u32string_view str, Char delimiter) {
+    return {str, SplitRange<Char>::Mode::Delimiter, delimiter};
+}
+
+/**
+ * Split a string into lines
+ * <p>
+ * Lines are separated by "\n" or "\r\n"; the line breaks are not part of the
+ * lines. A line break at the very end of the string does not start another line.
+ * @param str The string to split; must outlive the result
+ * @returns A lazy range of views into `str'
+ */
+inline SplitRange<char> SplitLines(std::string_view str) {
+    return {str, SplitRange<char>::Mode::Lines};
+}
+
+inline SplitRange<Char> SplitLines(std::u32string_view str) {
+    return {str, SplitRange<Char>::Mode::Lines};
+}
+
+/**
+ * Split a string into whitespace-separated tokens
+ * @param str The string to split; must outlive the result
+ * @returns A lazy range of views into `str' that contains no empty views
+ */
+inline SplitRange<char> Tokenize(std::string_view str) {
+    return {str, SplitRange<char>::Mode::Whitespace};
+}
+
+inline SplitRange<Char> Tokenize(std::u32string_view str) {
+    return {str, SplitRange<Char>::Mode::Whitespace};
+}
+
 /**
  * Trim leading and trailing whitespace
  * @tparam TString The string type to be used
  * @param tstring The string to trim
  * @returns A copy of `tstring' with leading and trailing whitespace removed
+ * @see TrimView
  */
 template <typename TString>
 TString Trim(const TString& tstring) requires(std::is_same_v<std::remove_cvref_t<decltype(tstring[0])>, char>) {
-    U64 start = 0, end = tstring.size() - 1;
-    while (start < end && std::isspace((unsigned char) tstring[start])) start++;
-    while (end > start && std::isspace((unsigned char) tstring[end])) end--;
-    return tstring.substr(start, end - start + !std::isspace((unsigned char) tstring[end]));
+    const std::string_view view{tstring.data(), tstring.size()};
+    const auto             trimmed = TrimView(view);
+    return tstring.substr(U64(trimmed.data() - view.data()), trimmed.size());
 }
 
 /**
@@ -202,6 +910,7 @@ TString Trim(const TString& tstring) requires(std::is_same_v<std::remove_cvref_t
 [[noreturn]] void _libutils_terminate(const std::string& errmsg);
 
 std::string Unescape(const std::string& str);
+std::pmr::string Unescape(std::string_view str, std::pmr::memory_resource* resource);
 
 LIBUTILS_NAMESPACE_END
 
@@ -0,0 +1,167 @@
+#include "../include/append-log.h"
+
+#include <bit>
+
+LIBUTILS_NAMESPACE_BEGIN
+
+AppendLog::AppendLog(FD _fd, AppendLogOptions options, _err_handler_t handler)
+    : capacity(std::bit_ceil(std::max<U64>(options.capacity, 2))),
+      sync_interval(options.sync_interval),
+      fd(_fd),
+      err_handler(std::move(handler)) {
+    slots = std::make_unique<Slot[]>(capacity);
+    for (U64 i = 0; i < capacity; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    flusher = std::thread{[this] { Flusher(); }};
+}
+
+AppendLog::AppendLog(const std::string& path, AppendLogOptions options, _err_handler_t handler)
+    : AppendLog(open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644), options, std::move(handler)) {
+    owns_fd = fd >= 0;
+    if (fd < 0) err_handler(std::string{"open(): "} + std::strerror(errno));
+}
+
+AppendLog::~AppendLog() {
+    stop.store(true);
+    Wake();
+    flusher.join();
+    if (owns_fd) close(fd);
+}
+
+bool AppendLog::Enqueue(std::string_view record, bool block) {
+    U64   pos = enqueue_pos.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot           = &slots[pos & (capacity - 1)];
+        const U64 seq  = slot->sequence.load(std::memory_order_acquire);
+        const I64 diff = I64(seq - pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            continue;
+        }
+
+        /// Another producer got here first; try the next slot.
+        if (diff > 0) {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+            continue;
+        }
+
+        /// The slot still holds the record from the previous lap, so the
+        /// log is full. Wait for the flusher to free some slots; the slot
+        /// is freed before written_pos is updated, so if it is still full
+        /// after we've read written_pos, we'll be woken once it changes.
+        if (!block) return false;
+        Wake();
+        const U64 written = written_pos.load(std::memory_order_acquire);
+        if (slot->sequence.load(std::memory_order_acquire) == seq) written_pos.wait(written, std::memory_order_acquire);
+        pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
+
+    slot->size = record.size();
+    if (record.size() > sizeof slot->data) {
+        slot->heap = std::make_unique_for_overwrite<char[]>(record.size());
+        std::memcpy(slot->heap.get(), record.data(), record.size());
+    } else {
+        std::memcpy(slot->data, record.data(), record.size());
+    }
+    /// Both this and the check for flusher_sleeping are sequentially
+    /// consistent, as is the other side in Flusher(), so that either it
+    /// sees this record or we see that it is going to sleep.
+    slot->sequence.store(pos + 1);
+    if (flusher_sleeping.load()) Wake();
+    return true;
+}
+
+void AppendLog::Wake() {
+    /// Taking the lock means that the flusher is either not asleep yet,
+    /// and will see whatever we want it to see, or waiting to be notified.
+    { std::unique_lock lock{mutex}; }
+    wakeup.notify_one();
+}
+
+U64 AppendLog::WriteBatch() {
+    iovec     iov[IOV_MAX];
+    const U64 start = written_pos.load(std::memory_order_relaxed);
+    U64       n     = 0;
+    for (; n < IOV_MAX; n++) {
+        const Slot& slot = slots[(start + n) & (capacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != start + n + 1) break;
+        iov[n] = {const_cast<char*>(slot.Data()), slot.size};
+    }
+    if (!n) return 0;
+
+    /// The records are dropped either way, since retrying is unlikely to
+    /// help, but Flush() has to know that they were lost.
+    if (!_libutils_write_all(fd, iov, n, err_handler)) failed.store(true, std::memory_order_relaxed);
+    for (U64 i = 0; i < n; i++) {
+        Slot& slot = slots[(start + i) & (capacity - 1)];
+        slot.heap.reset();
+        slot.sequence.store(start + i + capacity, std::memory_order_release);
+    }
+    written_pos.store(start + n, std::memory_order_release);
+    written_pos.notify_all();
+    return n;
+}
+
+void AppendLog::Sync() {
+    const U64 written = written_pos.load(std::memory_order_relaxed);
+    if (fdatasync(fd) < 0) {
+        failed.store(true, std::memory_order_relaxed);
+        err_handler(std::string{"fdatasync(): "} + std::strerror(errno));
+    }
+    synced_pos.store(written, std::memory_order_release);
+    synced_pos.notify_all();
+}
+
+void AppendLog::Flusher() {
+    using Clock    = std::chrono::steady_clock;
+    auto last_sync = Clock::now();
+    for (;;) {
+        /// Keep writing as long as there is anything to write; records
+        /// that are appended while we're writing form the next batch.
+        if (WriteBatch() == IOV_MAX) continue;
+
+        /// Group commit: sync everything written so far at once. A sync
+        /// that was requested by Flush() may cover records that haven't
+        /// been published yet; there is no point in syncing again until
+        /// we've written some of them.
+        const U64  written = written_pos.load(std::memory_order_relaxed);
+        const auto now     = Clock::now();
+        const bool due     = sync_interval.count() && now - last_sync >= sync_interval;
+        if (written > synced_pos.load(std::memory_order_relaxed) && (due || sync_target.load(std::memory_order_acquire) > synced_pos.load())) {
+            Sync();
+            last_sync = now;
+        }
+
+        if (stop.load() && written == enqueue_pos.load(std::memory_order_acquire)) break;
+
+        std::unique_lock lock{mutex};
+        flusher_sleeping.store(true);
+        const Slot& next     = slots[written & (capacity - 1)];
+        const bool  ready    = next.sequence.load() == written + 1;
+        const bool  unsynced = written > synced_pos.load(std::memory_order_relaxed);
+        const bool  wanted   = unsynced && sync_target.load(std::memory_order_acquire) > synced_pos.load(std::memory_order_relaxed);
+        if (!ready && !wanted && !stop.load()) {
+            if (sync_interval.count() && unsynced) wakeup.wait_until(lock, last_sync + sync_interval);
+            else wakeup.wait(lock);
+        }
+        flusher_sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    if (sync_interval.count() && written_pos.load() > synced_pos.load()) Sync();
+}
+
+bool AppendLog::Flush(bool sync) {
+    const U64 target = enqueue_pos.load(std::memory_order_acquire);
+    if (sync) {
+        U64 current = sync_target.load(std::memory_order_relaxed);
+        while (current < target && !sync_target.compare_exchange_weak(current, target, std::memory_order_release));
+    }
+    Wake();
+
+    auto& pos = sync ? synced_pos : written_pos;
+    for (U64 current = pos.load(std::memory_order_acquire); current < target; current = pos.load(std::memory_order_acquire))
+        pos.wait(current, std::memory_order_acquire);
+    return !failed.load(std::memory_order_relaxed);
+}
+
+LIBUTILS_NAMESPACE_END
@@ -0,0 +1,86 @@
+#include "../include/arena.h"
+
+LIBUTILS_NAMESPACE_BEGIN
+
+Arena::Arena(U64 chunk_size, std::pmr::memory_resource* _upstream)
+    : next_chunk_size(std::max<U64>(chunk_size, 2 * sizeof(Chunk))),
+      initial_chunk_size(next_chunk_size),
+      upstream(_upstream) {}
+
+Arena::~Arena() {
+    FreeChunks(false);
+}
+
+Arena::Chunk* Arena::NewChunk(U64 size, Chunk*& list) {
+    auto* chunk = static_cast<Chunk*>(upstream->allocate(size, alignof(std::max_align_t)));
+    chunk->size = size;
+    chunk->next = list;
+    list        = chunk;
+    return chunk;
+}
+
+void* Arena::AllocateSlow(U64 size, U64 align) {
+    const U64 needed = sizeof(Chunk) + size + align;
+
+    /// Large allocations get a chunk of their own so that we don't throw
+    /// away the rest of the current chunk. Keep them on a separate list
+    /// so that Reset() never keeps one of them instead of the first chunk.
+    if (needed > next_chunk_size / 2) {
+        auto*      chunk   = NewChunk(needed, large_chunks);
+        const auto start   = reinterpret_cast<std::uintptr_t>(chunk + 1);
+        const auto aligned = (start + (align - 1)) & ~std::uintptr_t(align - 1);
+        bytes_used += size;
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    /// Otherwise, start a new chunk and grow geometrically.
+    U64 chunk_size = next_chunk_size;
+    while (chunk_size < needed) chunk_size *= 2;
+    next_chunk_size = std::min(chunk_size * 2, std::max(MaxChunkSize, initial_chunk_size));
+
+    auto* chunk = NewChunk(chunk_size, chunks);
+    ptr         = reinterpret_cast<char*>(chunk + 1);
+    end         = reinterpret_cast<char*>(chunk) + chunk_size;
+    return Allocate(size, align);
+}
+
+void Arena::FreeChunks(bool keep_oldest) {
+    for (Chunk* chunk = large_chunks; chunk;) {
+        Chunk* next = chunk->next;
+        upstream->deallocate(chunk, chunk->size, alignof(std::max_align_t));
+        chunk = next;
+    }
+    large_chunks = nullptr;
+
+    Chunk* chunk = chunks;
+    while (chunk) {
+        Chunk* next = chunk->next;
+        if (keep_oldest && !next) {
+            chunk->next = nullptr;
+            chunks      = chunk;
+            ptr         = reinterpret_cast<char*>(chunk + 1);
+            end         = reinterpret_cast<char*>(chunk) + chunk->size;
+            return;
+        }
+        upstream->deallocate(chunk, chunk->size, alignof(std::max_align_t));
+        chunk = next;
+    }
+
+    chunks = nullptr;
+    ptr    = nullptr;
+    end    = nullptr;
+}
+
+void Arena::Reset() {
+    FreeChunks(true);
+    bytes_used      = 0;
+    next_chunk_size = initial_chunk_size;
+}
+
+void Arena::Release() {
+    FreeChunks(false);
+    bytes_used      = 0;
+    next_chunk_size = initial_chunk_size;
+}
+
+LIBUTILS_NAMESPACE_END
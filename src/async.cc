@@ -0,0 +1,416 @@
+#include "../include/async.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+
+/// read() and write() never transfer more than this in one go anyway.
+static constexpr U64 MaxTransfer = 0x7ffff000;
+
+/*
+ * io_uring backend.
+ *
+ * We talk to the kernel directly instead of going through liburing; all we
+ * need is to set up the rings, fill in submission queue entries, and reap
+ * completion queue entries.
+ */
+struct IOEngine::URing {
+    int fd = -1;
+
+    void* sq_ring      = MAP_FAILED;
+    void* cq_ring      = MAP_FAILED;
+    U64   sq_ring_size = 0;
+    U64   cq_ring_size = 0;
+
+    U32*          sq_head{};
+    U32*          sq_tail{};
+    U32*          sq_array{};
+    U32           sq_mask{};
+    U32           sq_entries{};
+    io_uring_sqe* sqes       = static_cast<io_uring_sqe*>(MAP_FAILED);
+    U64           sqes_size  = 0;
+    U32           local_tail = 0; /// Tail including entries that haven't been published yet
+    U32           to_submit  = 0; /// Entries that have been published but not submitted
+
+    U32*          cq_head{};
+    U32*          cq_tail{};
+    U32           cq_mask{};
+    io_uring_cqe* cqes{};
+
+    /** Set up a ring; returns false if io_uring isn't available */
+    bool Init(U32 entries);
+
+    ~URing() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (fd >= 0) close(fd);
+    }
+
+    /** Get a free submission queue entry, or nullptr if the queue is full */
+    io_uring_sqe* NextSQE() {
+        const U32 head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+        if (local_tail - head >= sq_entries) return nullptr;
+        const U32 idx = local_tail & sq_mask;
+        sq_array[idx] = idx;
+        local_tail++;
+        std::memset(&sqes[idx], 0, sizeof(io_uring_sqe));
+        return &sqes[idx];
+    }
+
+    /** Make all entries returned by NextSQE() visible to the kernel */
+    void Publish() {
+        to_submit += local_tail - *sq_tail;
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    }
+
+    /**
+     * Submit published entries and optionally wait for completions
+     * @return 0, or the errno value if io_uring_enter() failed
+     */
+    int Enter(U32 min_complete) {
+        for (;;) {
+            const U32  flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+            const long ret   = syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+            if (ret >= 0) {
+                to_submit -= U32(ret);
+                return 0;
+            }
+            if (errno == EINTR) continue;
+
+            /// The completion queue is full; the caller has to reap first.
+            if (errno == EBUSY || errno == EAGAIN) return 0;
+            return errno;
+        }
+    }
+
+    /**
+     * Take back the entries that were published but not submitted and
+     * move their operations to `out', failing them with `error'
+     * <p>
+     * The kernel only looks at the submission queue when we enter it, so
+     * entries it hasn't consumed yet can simply be removed again.
+     */
+    void Fail(int error, std::vector<IOOperation*>& out) {
+        Publish();
+        const U32 tail = *sq_tail;
+        for (U32 i = tail - to_submit; i != tail; i++) {
+            auto* op   = reinterpret_cast<IOOperation*>(sqes[sq_array[i & sq_mask]].user_data);
+            op->result = -error;
+            out.push_back(op);
+        }
+        local_tail = tail - to_submit;
+        to_submit  = 0;
+        __atomic_store_n(sq_tail, local_tail, __ATOMIC_RELEASE);
+    }
+
+    /** Move all available completions to `out' */
+    void Reap(std::vector<IOOperation*>& out) {
+        U32       head = *cq_head;
+        const U32 tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            const io_uring_cqe& cqe = cqes[head & cq_mask];
+            auto*               op  = reinterpret_cast<IOOperation*>(cqe.user_data);
+            op->result              = cqe.res;
+            out.push_back(op);
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+};
+
+bool IOEngine::URing::Init(U32 entries) {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CLAMP;
+    fd           = int(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) return false;
+
+    /// We rely on the kernel supporting reads and writes at the current position.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS)) return false;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(U32);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) return false;
+    cq_ring = single_mmap ? sq_ring : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED) return false;
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes      = static_cast<io_uring_sqe*>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) return false;
+
+    auto* sq   = static_cast<char*>(sq_ring);
+    sq_head    = reinterpret_cast<U32*>(sq + params.sq_off.head);
+    sq_tail    = reinterpret_cast<U32*>(sq + params.sq_off.tail);
+    sq_array   = reinterpret_cast<U32*>(sq + params.sq_off.array);
+    sq_mask    = *reinterpret_cast<U32*>(sq + params.sq_off.ring_mask);
+    sq_entries = *reinterpret_cast<U32*>(sq + params.sq_off.ring_entries);
+    local_tail = *sq_tail;
+
+    auto* cq = static_cast<char*>(cq_ring);
+    cq_head  = reinterpret_cast<U32*>(cq + params.cq_off.head);
+    cq_tail  = reinterpret_cast<U32*>(cq + params.cq_off.tail);
+    cq_mask  = *reinterpret_cast<U32*>(cq + params.cq_off.ring_mask);
+    cqes     = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+/*
+ * Thread pool backend.
+ *
+ * Worker threads perform the blocking system calls and hand the
+ * operations back to the thread that runs the engine.
+ */
+struct IOEngine::ThreadPool {
+    std::mutex                mutex;
+    std::condition_variable   work_available;
+    std::condition_variable   work_done;
+    std::deque<IOOperation*>  work;
+    std::vector<IOOperation*> done;
+    std::vector<std::thread>  threads;
+    bool                      stop = false;
+
+    explicit ThreadPool(U32 n_threads) {
+        for (U32 i = 0; i < n_threads; i++) threads.emplace_back([this] { Work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::unique_lock lock{mutex};
+            stop = true;
+        }
+        work_available.notify_all();
+        for (auto& t : threads) t.join();
+    }
+
+    void Work() {
+        for (;;) {
+            IOOperation* op;
+            {
+                std::unique_lock lock{mutex};
+                work_available.wait(lock, [this] { return stop || !work.empty(); });
+                if (work.empty()) return;
+                op = work.front();
+                work.pop_front();
+            }
+
+            Execute(op);
+
+            {
+                std::unique_lock lock{mutex};
+                done.push_back(op);
+            }
+            work_done.notify_one();
+        }
+    }
+
+    static void Execute(IOOperation* op) {
+        using enum IOOperation::Kind;
+        const U64 len = std::min(op->length, MaxTransfer);
+        const auto off = off_t(op->offset);
+        const bool cur = op->offset == CurrentPosition;
+        I64        ret;
+        do {
+            switch (op->kind) {
+                case Read: ret = cur ? read(op->fd, op->buffer, len) : pread(op->fd, op->buffer, len, off); break;
+                case Write: ret = cur ? write(op->fd, op->buffer, len) : pwrite(op->fd, op->buffer, len, off); break;
+                case Open: ret = openat(AT_FDCWD, op->path.c_str(), op->flags, op->mode); break;
+                case Close: ret = close(op->fd); break;
+                default: LIBUTILS_UNREACHABLE();
+            }
+        } while (ret < 0 && errno == EINTR && op->kind != Close);
+        op->result = ret < 0 ? -errno : ret;
+    }
+};
+
+void IOOperation::await_suspend(std::coroutine_handle<> h) {
+    waiter = h;
+    engine->Queue(this);
+}
+
+IOEngine::IOEngine(U32 queue_depth, bool use_io_uring, _err_handler_t handler) : err_handler(std::move(handler)) {
+    queue_depth = std::max<U32>(queue_depth, 1);
+    if (use_io_uring) {
+        ring = std::make_unique<URing>();
+        if (!ring->Init(queue_depth)) ring.reset();
+    }
+
+    if (!ring) {
+        const U32 n_threads = std::clamp<U32>(std::thread::hardware_concurrency(), 4, 32);
+        pool                = std::make_unique<ThreadPool>(std::min(n_threads, queue_depth));
+    }
+}
+
+IOEngine::~IOEngine() {
+    /// The kernel or a worker thread may still be writing to memory owned
+    /// by a suspended coroutine, so wait for everything to complete before
+    /// destroying any of them. Operations that have already been reaped
+    /// but whose coroutines haven't been resumed are done.
+    in_flight -= completed.size();
+    completed.clear();
+    while (in_flight) {
+        if (ring) {
+            Submit(1);
+            ring->Reap(completed);
+        } else {
+            std::unique_lock lock{pool->mutex};
+            if (!queued.empty()) {
+                pool->work.insert(pool->work.end(), queued.begin(), queued.end());
+                queued.clear();
+                pool->work_available.notify_all();
+            }
+            pool->work_done.wait(lock, [this] { return !pool->done.empty(); });
+            completed.swap(pool->done);
+            pool->done.clear();
+        }
+        in_flight -= completed.size();
+        completed.clear();
+    }
+}
+
+bool IOEngine::Submit(U32 min_complete) {
+    ring->Publish();
+    const int error = ring->Enter(min_complete);
+    if (!error) return true;
+
+    /// Whatever the kernel didn't take fails; everything it did take
+    /// will still complete normally.
+    err_handler(std::string{"io_uring_enter(): "} + std::strerror(error));
+    ring->Fail(error, completed);
+    return false;
+}
+
+void IOEngine::Queue(IOOperation* op) {
+    in_flight++;
+    if (!ring) {
+        queued.push_back(op);
+        return;
+    }
+
+    io_uring_sqe* sqe = ring->NextSQE();
+    while (!sqe) {
+        /// The submission queue is full; submit what we have.
+        Submit(0);
+        sqe = ring->NextSQE();
+        if (!sqe) {
+            /// The kernel refused to take more because the completion queue
+            /// is full. Make room by reaping completions, but don't resume
+            /// their coroutines; we're in the middle of suspending one, so
+            /// that is left to Step().
+            const U64 reaped = completed.size();
+            ring->Reap(completed);
+            if (completed.size() == reaped) Submit(1);
+            sqe = ring->NextSQE();
+        }
+    }
+
+    using enum IOOperation::Kind;
+    switch (op->kind) {
+        case Read:
+        case Write:
+            sqe->opcode = op->kind == Read ? IORING_OP_READ : IORING_OP_WRITE;
+            sqe->fd     = op->fd;
+            sqe->addr   = reinterpret_cast<U64>(op->buffer);
+            sqe->len    = U32(std::min(op->length, MaxTransfer));
+            sqe->off    = op->offset;
+            break;
+        case Open:
+            sqe->opcode     = IORING_OP_OPENAT;
+            sqe->fd         = AT_FDCWD;
+            sqe->addr       = reinterpret_cast<U64>(op->path.c_str());
+            sqe->len        = op->mode;
+            sqe->open_flags = U32(op->flags);
+            break;
+        case Close:
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd     = op->fd;
+            break;
+        default: LIBUTILS_UNREACHABLE();
+    }
+    sqe->user_data = reinterpret_cast<U64>(op);
+}
+
+void IOEngine::Step() {
+    if (!in_flight) return;
+
+    /// Submit the batch and wait for at least one completion in one go;
+    /// `completed' may already hold completions reaped by Queue().
+    if (ring) {
+        ring->Publish();
+        ring->Reap(completed);
+        if (completed.empty()) {
+            if (!Submit(1)) {
+                /// We can't wait in the kernel, so poll instead; any system
+                /// call lets the kernel run pending completions.
+                for (ring->Reap(completed); completed.empty(); ring->Reap(completed)) sched_yield();
+            }
+            ring->Reap(completed);
+        } else if (ring->to_submit) {
+            Submit(0);
+        }
+    } else {
+        std::unique_lock lock{pool->mutex};
+        if (!queued.empty()) {
+            pool->work.insert(pool->work.end(), queued.begin(), queued.end());
+            queued.clear();
+            pool->work_available.notify_all();
+        }
+        pool->work_done.wait(lock, [this] { return !pool->done.empty(); });
+        completed.insert(completed.end(), pool->done.begin(), pool->done.end());
+        pool->done.clear();
+    }
+
+    /// Resuming a coroutine may queue new operations and even call Step()
+    /// recursively, so don't touch `completed' while doing so.
+    auto ready = std::move(completed);
+    completed  = {};
+    in_flight -= ready.size();
+    for (auto* op : ready) op->waiter.resume();
+    if (completed.empty()) {
+        ready.clear();
+        completed = std::move(ready);
+    }
+}
+
+void IOEngine::Reap() {
+    std::exception_ptr exception;
+    std::erase_if(tasks, [&](co_task<>& task) {
+        if (!task.done()) return false;
+        if (!exception) {
+            try {
+                task.result();
+            } catch (...) {
+                exception = std::current_exception();
+            }
+        }
+        return true;
+    });
+    if (exception) std::rethrow_exception(exception);
+}
+
+void IOEngine::Spawn(co_task<> task) {
+    tasks.push_back(std::move(task));
+    static_cast<co_task<>::co_handle>(tasks.back()).resume();
+}
+
+void IOEngine::Run() {
+    for (;;) {
+        Reap();
+        if (tasks.empty()) break;
+
+        /// Nothing we could wait for would ever resume the remaining tasks.
+        if (!in_flight) {
+            err_handler("IOEngine::Run(): tasks are suspended on something other than an I/O operation");
+            break;
+        }
+        Step();
+    }
+}
@@ -81,7 +81,7 @@ std::string Clopts::Usage() {
 }
 
 void Clopts::Parse(int argc, char** argv) {
-    program_name = Trim(std::string{argv[0]});
+    program_name = TrimView(argv[0]);
     for (int i = 1; i < argc; i++) {
         /// Empty strings are allowed as arguments, but not as options
         if (argv[i][0] == 0) {
@@ -89,7 +89,7 @@ void Clopts::Parse(int argc, char** argv) {
             continue;
         }
 
-        std::string_view option_raw(Trim(std::string_view(argv[i])));
+        std::string_view option_raw(TrimView(argv[i]));
         std::string_view option(option_raw);
 
         /// Print the help information if the help flag is enabled
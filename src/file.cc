@@ -1,8 +1,15 @@
 #include "../include/file.h"
 
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+
+extern char** environ;
+
 struct PipePair {
     int _pair[2] = {-1, -1};
-    PipePair() { pipe(_pair); }
+    PipePair() { pipe2(_pair, O_CLOEXEC); }
     ~PipePair() {
         if (_pair[0] != -1) close(_pair[0]);
         if (_pair[1] != -1) close(_pair[1]);
@@ -10,40 +17,390 @@ struct PipePair {
     LIBUTILS_NON_COPYABLE_NON_MOVABLE(PipePair);
 };
 
-SynchronousPipe::SynchronousPipe(const std::string& command, _err_handler_t handler) {
-    PipePair p_in, p_out, p_err;
-    pid_t    pid = vfork();
-    if (pid < 0) return;
+#if !__GLIBC_PREREQ(2, 34)
+namespace {
+/// Close every descriptor from 3 up, except `keep'. This runs in a forked
+/// child, so it must only make async-signal-safe calls.
+void CloseFrom3Except(int keep) {
+#    ifdef SYS_close_range
+    if ((keep <= 3 || syscall(SYS_close_range, 3U, unsigned(keep - 1), 0U) == 0) &&
+        syscall(SYS_close_range, unsigned(std::max(keep + 1, 3)), ~0U, 0U) == 0) return;
+#    endif
+    rlimit lim{};
+    const int max = getrlimit(RLIMIT_NOFILE, &lim) == 0 && lim.rlim_cur != RLIM_INFINITY ? int(std::min<rlim_t>(lim.rlim_cur, INT_MAX)) : 65536;
+    for (int fd = 3; fd < max; fd++)
+        if (fd != keep) close(fd);
+}
+
+/// Set up the child and exec the program; only returns, with an errno value, on failure.
+int ExecChild(const char* file, char* const argv[], char* const envp[], const char* cwd, const FD (&stdio)[3], int status_fd) {
+    for (int i = 0; i < 3; i++)
+        if ((stdio[i] == i ? fcntl(i, F_SETFD, 0) : dup2(stdio[i], i)) < 0) return errno;
+    if (cwd && chdir(cwd) < 0) return errno;
+    CloseFrom3Except(status_fd);
+    if (std::strchr(file, '/')) execve(file, argv, envp);
+    else execvpe(file, argv, envp);
+    return errno;
+}
+
+/// posix_spawn() can only close descriptors that aren't close-on-exec
+/// since glibc 2.34, so fork and close them ourselves. Errors in the child
+/// are sent back through a close-on-exec pipe, which reads EOF if the exec
+/// succeeded.
+pid_t ForkExec(const char* file, char* const argv[], char* const envp[], const char* cwd, const FD (&stdio)[3]) {
+    PipePair status;
+    if (status._pair[0] == -1) return -1;
+
+    const pid_t pid = fork();
+    if (pid < 0) return -1;
     if (pid == 0) {
-        dup2(p_in._pair[0], STDIN_FILENO);
-        dup2(p_out._pair[1], STDOUT_FILENO);
-        dup2(p_err._pair[1], STDERR_FILENO);
-        p_in.~PipePair();
-        p_out.~PipePair();
-        p_err.~PipePair();
-        execlp("/bin/bash", "bash", "-c", command.c_str(), nullptr);
-        exit(127);
+        const int err = ExecChild(file, argv, envp, cwd, stdio, status._pair[1]);
+        (void) !write(status._pair[1], &err, sizeof err);
+        _exit(127);
     }
-    in.fd         = p_in._pair[1];
-    p_in._pair[1] = -1;
 
-    out.fd         = p_out._pair[0];
-    p_out._pair[0] = -1;
+    close(status._pair[1]);
+    status._pair[1] = -1;
+    int err{};
+    I64 n;
+    while ((n = read(status._pair[0], &err, sizeof err)) < 0 && errno == EINTR);
+    if (n != sizeof err) return pid;
+    while (waitpid(pid, nullptr, 0) < 0 && errno == EINTR);
+    errno = err;
+    return -1;
+}
+} // namespace
+#endif
+
+pid_t _libutils_spawn(const char* file, char* const argv[], char* const envp[], const char* cwd, const FD (&stdio)[3], bool close_fds) {
+#if !__GLIBC_PREREQ(2, 34)
+    if (close_fds) return ForkExec(file, argv, envp, cwd, stdio);
+#endif
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    /// dup2() clears O_CLOEXEC, so the child gets exactly these three.
+    for (int i = 0; i < 3; i++) posix_spawn_file_actions_adddup2(&actions, stdio[i], i);
+    if (cwd) posix_spawn_file_actions_addchdir_np(&actions, cwd);
+#if __GLIBC_PREREQ(2, 34)
+    if (close_fds) posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
 
-    err.fd         = p_err._pair[0];
-    p_err._pair[0] = -1;
+    pid_t     pid{};
+    const int ret = std::strchr(file, '/')
+                      ? posix_spawn(&pid, file, &actions, nullptr, argv, envp)
+                      : posix_spawnp(&pid, file, &actions, nullptr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    if (ret != 0) {
+        errno = ret;
+        return -1;
+    }
+    return pid;
+}
 
+SynchronousPipe::SynchronousPipe(const std::string& command, _err_handler_t handler) {
     in.err_handler  = handler;
     out.err_handler = handler;
     err.err_handler = handler;
 
+    /// The output goes to memory files rather than pipes so that the command
+    /// can't block on a full pipe while we're waiting for it to exit.
+    PipePair p_in;
+    out.fd = memfd_create("stdout", MFD_CLOEXEC);
+    err.fd = memfd_create("stderr", MFD_CLOEXEC);
+    if (out.fd < 0 || err.fd < 0) {
+        handler(std::string{"memfd_create(): "} + std::strerror(errno));
+        return;
+    }
+
+    const char* argv[] = {"bash", "-c", command.c_str(), nullptr};
+    const pid_t pid    = _libutils_spawn("/bin/bash", const_cast<char* const*>(argv), environ, nullptr,
+                                         {p_in._pair[0], out.fd, err.fd}, false);
+    if (pid < 0) {
+        handler(std::string{"posix_spawn(): "} + std::strerror(errno));
+        return;
+    }
+    in.fd         = p_in._pair[1];
+    p_in._pair[1] = -1;
+
     int wstatus{};
     do
         if (waitpid(pid, &wstatus, 0) < 0) {
+            if (errno == EINTR) continue;
             handler(std::string{"waitpid() failed: "} + std::strerror(errno));
             return;
         }
-    while (!WIFEXITED(wstatus));
-    status = WEXITSTATUS(wstatus);
-    valid  = true;
+    while (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus));
+    status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+
+    /// We share the file offsets with the command, so rewind to read what it wrote.
+    lseek(out.fd, 0, SEEK_SET);
+    lseek(err.fd, 0, SEEK_SET);
+    valid = true;
+}
+
+namespace {
+/// Skip the buffers that were written completely, and continue
+/// in the middle of the one that wasn't.
+void SkipWritten(iovec*& iov, U64& count, U64 n) {
+    while (count && n >= iov->iov_len) {
+        n -= iov->iov_len;
+        iov++;
+        count--;
+    }
+    if (count) {
+        iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+        iov->iov_len -= n;
+    }
+}
+} // namespace
+
+bool _libutils_write_all(FD fd, iovec* iov, U64 count, const _err_handler_t& handler) {
+    while (count) {
+        const I64 n_written = writev(fd, iov, int(std::min<U64>(count, IOV_MAX)));
+        if (n_written < 0) {
+            if (errno == EINTR) continue;
+            handler(std::string{"writev(): "} + std::strerror(errno));
+            return false;
+        }
+        SkipWritten(iov, count, U64(n_written));
+
+        /// Writing nothing is only fine if the remaining buffers were all
+        /// empty; otherwise, retrying would just keep returning 0.
+        if (n_written == 0 && count) {
+            handler("writev(): no progress");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool _libutils_pwrite_all(FD fd, iovec* iov, U64 count, U64 offset, const _err_handler_t& handler) {
+    while (count) {
+        const I64 n_written = pwritev(fd, iov, int(std::min<U64>(count, IOV_MAX)), off_t(offset));
+        if (n_written < 0) {
+            if (errno == EINTR) continue;
+            handler(std::string{"pwritev(): "} + std::strerror(errno));
+            return false;
+        }
+        offset += U64(n_written);
+        SkipWritten(iov, count, U64(n_written));
+        if (n_written == 0 && count) {
+            handler("pwritev(): no progress");
+            return false;
+        }
+    }
+    return true;
+}
+
+namespace {
+/// read(), write(), and friends never transfer more than this at once anyway.
+constexpr U64 MaxTransfer = 0x7ffff000;
+
+/// Size of the buffer used if the data can't bypass user space.
+constexpr U64 CopyBufferSize = 128 * 1024;
+
+enum struct TransferResult {
+    Done,
+    Unsupported,
+    Failed,
+};
+
+/// Whether an error means that a system call doesn't support these files.
+bool Unsupported(int err) {
+    return err == EINVAL || err == EXDEV || err == EOPNOTSUPP || err == ENOSYS;
+}
+
+/// Call `transfer' until `n' bytes have been transferred or it reports EOF.
+template <typename Callable>
+TransferResult Transfer(U64& total, U64 n, const char* name, const _err_handler_t& handler, Callable transfer) {
+    while (total < n) {
+        const I64 ret = transfer(std::min(n - total, MaxTransfer));
+        if (ret > 0) {
+            total += U64(ret);
+            continue;
+        }
+        if (ret == 0) break;
+        if (errno == EINTR) continue;
+        if (Unsupported(errno)) return TransferResult::Unsupported;
+        handler(std::string{name} + "(): " + std::strerror(errno));
+        return TransferResult::Failed;
+    }
+    return TransferResult::Done;
+}
+
+/// Copy through a buffer, starting with `total' bytes already copied.
+U64 CopyBuffered(FD from, FD to, U64 n, U64 total, const _err_handler_t& handler) {
+    const auto buffer = std::make_unique_for_overwrite<char[]>(CopyBufferSize);
+    while (total < n) {
+        const I64 n_read = read(from, buffer.get(), std::min(n - total, CopyBufferSize));
+        if (n_read == 0) break;
+        if (n_read < 0) {
+            if (errno == EINTR) continue;
+            handler(std::string{"read(): "} + std::strerror(errno));
+            break;
+        }
+        iovec iov{buffer.get(), U64(n_read)};
+        if (!_libutils_write_all(to, &iov, 1, handler)) break;
+        total += U64(n_read);
+    }
+    return total;
+}
+
+bool Stat(FD fd, struct stat& st, const _err_handler_t& handler) {
+    if (fstat(fd, &st) == 0) return true;
+    handler(std::string{"fstat(): "} + std::strerror(errno));
+    return false;
+}
+} // namespace
+
+U64 _libutils_copy(FD from, FD to, U64 n, const _err_handler_t& handler) {
+    struct stat in {}, out{};
+    if (!Stat(from, in, handler) || !Stat(to, out, handler)) return 0;
+
+    /// Each of these picks up where the previous one left off, since they
+    /// all advance the file offsets.
+    U64  total = 0;
+    auto res   = TransferResult::Unsupported;
+
+    /// copy_file_range() fails with EBADF if the output is in append mode;
+    /// that is the only case where EBADF doesn't mean a bad descriptor.
+    const int out_flags = fcntl(to, F_GETFL);
+    if (S_ISREG(in.st_mode) && S_ISREG(out.st_mode) && out_flags >= 0 && !(out_flags & O_APPEND)) {
+        res = Transfer(total, n, "copy_file_range", handler, [&](U64 len) {
+            return copy_file_range(from, nullptr, to, nullptr, len, 0);
+        });
+    }
+    if (res == TransferResult::Unsupported && S_ISREG(in.st_mode)) {
+        res = Transfer(total, n, "sendfile", handler, [&](U64 len) { return sendfile(to, from, nullptr, len); });
+    }
+    if (res == TransferResult::Unsupported && (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode))) {
+        res = Transfer(total, n, "splice", handler, [&](U64 len) {
+            return splice(from, nullptr, to, nullptr, len, SPLICE_F_MOVE);
+        });
+    }
+    if (res == TransferResult::Unsupported) total = CopyBuffered(from, to, n, total, handler);
+    return total;
+}
+
+U64 _libutils_splice(FD from, FD to, U64 n, const _err_handler_t& handler) {
+    struct stat in {}, out{};
+    if (!Stat(from, in, handler) || !Stat(to, out, handler)) return 0;
+
+    U64 total = 0;
+    if (S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode)) {
+        const auto res = Transfer(total, n, "splice", handler, [&](U64 len) {
+            return splice(from, nullptr, to, nullptr, len, SPLICE_F_MOVE);
+        });
+        if (res == TransferResult::Unsupported) total = CopyBuffered(from, to, n, total, handler);
+        return total;
+    }
+
+    /// Neither end is a pipe, so go through one of our own.
+    FD pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) < 0) return CopyBuffered(from, to, n, 0, handler);
+    fcntl(pipe_fds[1], F_SETPIPE_SZ, 1 << 20);
+
+    bool fallback = false, failed = false;
+    while (total < n && !fallback && !failed) {
+        const I64 n_in = splice(from, nullptr, pipe_fds[1], nullptr, std::min(n - total, MaxTransfer), SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n_in == 0) break;
+        if (n_in < 0) {
+            if (errno == EINTR) continue;
+            fallback = Unsupported(errno);
+            failed   = !fallback;
+            if (failed) handler(std::string{"splice(): "} + std::strerror(errno));
+            break;
+        }
+
+        /// Empty the pipe again before filling it any further.
+        for (U64 left = U64(n_in); left;) {
+            const I64 n_out = splice(pipe_fds[0], nullptr, to, nullptr, left, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (n_out > 0) {
+                left -= U64(n_out);
+                total += U64(n_out);
+                continue;
+            }
+            if (n_out < 0 && errno == EINTR) continue;
+            if (n_out < 0 && Unsupported(errno)) {
+                /// The data that is already in the pipe has to be written the slow way.
+                const U64 flushed = CopyBuffered(pipe_fds[0], to, left, 0, handler);
+                total += flushed;
+                fallback = flushed == left;
+                failed   = !fallback;
+            } else {
+                handler(std::string{"splice(): "} + std::strerror(errno));
+                failed = true;
+            }
+            break;
+        }
+    }
+
+    close(pipe_fds[0]);
+    close(pipe_fds[1]);
+    if (fallback) total = CopyBuffered(from, to, n, total, handler);
+    return total;
+}
+
+U64 _libutils_tee(FD from, FD first, FD second, U64 n, const _err_handler_t& handler) {
+    struct stat in {}, out{};
+    if (!Stat(from, in, handler) || !Stat(first, out, handler)) return 0;
+
+    /// tee() duplicates the data without consuming it, so move the same
+    /// bytes to the second file afterwards.
+    U64 total = 0;
+    if (S_ISFIFO(in.st_mode) && S_ISFIFO(out.st_mode)) {
+        while (total < n) {
+            const I64 n_teed = tee(from, first, std::min(n - total, MaxTransfer), 0);
+            if (n_teed == 0) return total;
+            if (n_teed < 0) {
+                if (errno == EINTR) continue;
+                if (Unsupported(errno)) break;
+                handler(std::string{"tee(): "} + std::strerror(errno));
+                return total;
+            }
+            const U64 n_moved = _libutils_copy(from, second, U64(n_teed), handler);
+            total += n_moved;
+            if (n_moved < U64(n_teed)) return total;
+        }
+    }
+
+    const auto buffer = std::make_unique_for_overwrite<char[]>(CopyBufferSize);
+    while (total < n) {
+        const I64 n_read = read(from, buffer.get(), std::min(n - total, CopyBufferSize));
+        if (n_read == 0) break;
+        if (n_read < 0) {
+            if (errno == EINTR) continue;
+            handler(std::string{"read(): "} + std::strerror(errno));
+            break;
+        }
+        iovec iov{buffer.get(), U64(n_read)};
+        if (!_libutils_write_all(first, &iov, 1, handler)) break;
+        iov = {buffer.get(), U64(n_read)};
+        if (!_libutils_write_all(second, &iov, 1, handler)) break;
+        total += U64(n_read);
+    }
+    return total;
+}
+
+void BufferedWriter::Flush() {
+    if (!used) return;
+    iovec iov{buffer.get(), used};
+    used = 0;
+    _libutils_write_all(fd, &iov, 1, err_handler);
+}
+
+void BufferedWriter::WriteSlow(std::string_view str) {
+    /// Small pieces are cheaper to copy than to write separately.
+    if (str.size() < capacity / 2) {
+        Flush();
+        std::memcpy(buffer.get(), str.data(), str.size());
+        used = str.size();
+        return;
+    }
+
+    iovec iov[2]{{buffer.get(), used}, {const_cast<char*>(str.data()), str.size()}};
+    used = 0;
+    _libutils_write_all(fd, iov, 2, err_handler);
 }
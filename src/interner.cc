@@ -0,0 +1,129 @@
+#include "../include/interner.h"
+
+#include <bit>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+LIBUTILS_NAMESPACE_BEGIN
+
+namespace {
+constexpr U64 HashSeed = 0xa0761d6478bd642f;
+constexpr U64 HashMul1 = 0xe7037ed1a0b428db;
+constexpr U64 HashMul2 = 0x8ebc6af09c88c6e3;
+
+/// Multiply two 64-bit numbers and fold the 128-bit result.
+U64 Mix(U64 a, U64 b) {
+    const auto r = static_cast<unsigned __int128>(a) * b;
+    return U64(r) ^ U64(r >> 64);
+}
+
+U64 Load(const char* p, U64 n) {
+    U64 v = 0;
+    std::memcpy(&v, p, n);
+    return v;
+}
+
+/// A fast non-cryptographic hash in the style of wyhash that
+/// consumes 16 bytes per iteration.
+U32 HashBytes(const char* data, U64 n) {
+    U64 h = HashSeed ^ n;
+    for (; n >= 16; data += 16, n -= 16) h = Mix(Load(data, 8) ^ HashMul1, Load(data + 8, 8) ^ h);
+    if (n >= 8) {
+        h = Mix(Load(data, 8) ^ HashMul1, h ^ HashMul2);
+        data += 8;
+        n -= 8;
+    }
+    if (n) h = Mix(Load(data, n) ^ HashMul1, h ^ HashMul2);
+    h = Mix(h ^ HashMul1, HashMul2);
+    return U32(h ^ (h >> 32));
+}
+
+template <typename TChar>
+U32 Hash(std::basic_string_view<TChar> str) {
+    return HashBytes(reinterpret_cast<const char*>(str.data()), str.size() * sizeof(TChar));
+}
+} // namespace
+
+template <typename TChar>
+Interner<TChar>::Interner() : slots(FirstSegmentSize, Slot{0, NoSymbol}) {}
+
+template <typename TChar>
+std::pair<U32, U32> Interner<TChar>::Locate(Symbol sym) {
+    const U64 x   = U64(sym) + FirstSegmentSize;
+    const U32 seg = U32(std::bit_width(x)) - FirstSegmentShift - 1;
+    return {seg, U32(x - (U64(FirstSegmentSize) << seg))};
+}
+
+template <typename TChar>
+Symbol Interner<TChar>::FindLocked(View str, U32 hash) const {
+    const U64 mask = slots.size() - 1;
+    for (U64 i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& slot = slots[i];
+        if (slot.symbol == NoSymbol) return NoSymbol;
+        if (slot.hash == hash && Str(slot.symbol) == str) return slot.symbol;
+    }
+}
+
+template <typename TChar>
+void Interner<TChar>::Grow() {
+    std::vector<Slot> old{slots.size() * 2, Slot{0, NoSymbol}};
+    std::swap(old, slots);
+    const U64 mask = slots.size() - 1;
+    for (const Slot& slot : old) {
+        if (slot.symbol == NoSymbol) continue;
+        U64 i = slot.hash & mask;
+        while (slots[i].symbol != NoSymbol) i = (i + 1) & mask;
+        slots[i] = slot;
+    }
+}
+
+template <typename TChar>
+Symbol Interner<TChar>::Intern(View str) {
+    const U32 hash = Hash(str);
+
+    /// Most strings have already been interned, so try a lookup first.
+    {
+        std::shared_lock lock{mutex};
+        if (auto sym = FindLocked(str, hash); sym != NoSymbol) return sym;
+    }
+
+    std::unique_lock lock{mutex};
+    if (auto sym = FindLocked(str, hash); sym != NoSymbol) return sym;
+
+    const Symbol sym = count.load(std::memory_order_relaxed);
+    if (sym == NoSymbol) throw std::length_error("Interner: out of symbols");
+
+    /// Keep the load factor below 3/4.
+    if ((U64(sym) + 1) * 4 > slots.size() * 3) Grow();
+
+    /// Store the string first so that the symbol is valid once it is visible.
+    auto [seg, idx] = Locate(sym);
+    View* segment   = segments[seg].load(std::memory_order_relaxed);
+    if (!segment) {
+        const U64 n = U64(FirstSegmentSize) << seg;
+        segment     = static_cast<View*>(arena.Allocate(n * sizeof(View), alignof(View)));
+        segments[seg].store(segment, std::memory_order_release);
+    }
+    segment[idx] = arena.Copy(str);
+
+    const U64 mask = slots.size() - 1;
+    U64       i    = hash & mask;
+    while (slots[i].symbol != NoSymbol) i = (i + 1) & mask;
+    slots[i] = Slot{hash, sym};
+    count.store(sym + 1, std::memory_order_release);
+    return sym;
+}
+
+template <typename TChar>
+Symbol Interner<TChar>::Find(View str) const {
+    const U32         hash = Hash(str);
+    std::shared_lock lock{mutex};
+    return FindLocked(str, hash);
+}
+
+template class Interner<char>;
+template class Interner<char8_t>;
+template class Interner<char32_t>;
+
+LIBUTILS_NAMESPACE_END
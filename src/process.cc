@@ -0,0 +1,584 @@
+#include "../include/process.h"
+
+#include <algorithm>
+#include <bit>
+#include <thread>
+#include <vector>
+
+extern char** environ;
+
+namespace {
+/// Size of the buffer that each of stdout and stderr is read into.
+constexpr U64 BufferSize = 256 * 1024;
+
+/// The kernel lets unprivileged processes grow pipes to 1 MiB by default;
+/// larger pipes mean fewer context switches for chatty children.
+constexpr int PipeSize = 1 << 20;
+
+struct PipeFDs {
+    FD fds[2] = {-1, -1};
+    PipeFDs() = default;
+    ~PipeFDs() {
+        if (fds[0] != -1) close(fds[0]);
+        if (fds[1] != -1) close(fds[1]);
+    }
+    LIBUTILS_NON_COPYABLE_NON_MOVABLE(PipeFDs);
+
+    /// The child gets its ends through dup2(), which clears O_CLOEXEC, so
+    /// none of our ends ever leak into it.
+    bool Open() { return pipe2(fds, O_CLOEXEC) == 0; }
+    FD   Take(U64 i) { return std::exchange(fds[i], -1); }
+};
+
+/// Write to a pipe without being killed by SIGPIPE if the reader has gone away.
+I64 WriteNoSigpipe(FD fd, std::string_view data) {
+    sigset_t sigpipe, old, pending;
+    sigemptyset(&sigpipe);
+    sigaddset(&sigpipe, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &sigpipe, &old);
+    sigpending(&pending);
+    const bool was_pending = sigismember(&pending, SIGPIPE);
+
+    I64 n_written;
+    do n_written = write(fd, data.data(), data.size());
+    while (n_written < 0 && errno == EINTR);
+    const int saved_errno = errno;
+
+    /// Swallow the SIGPIPE we just raised so it isn't delivered once we unblock it.
+    if (n_written < 0 && errno == EPIPE && !was_pending) {
+        static constexpr timespec zero{};
+        while (sigtimedwait(&sigpipe, nullptr, &zero) < 0 && errno == EINTR);
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, nullptr);
+    errno = saved_errno;
+    return n_written;
+}
+
+void CloseFD(FD& fd) {
+    if (fd != -1) close(fd);
+    fd = -1;
+}
+
+/// Spawn a program with the given standard streams; returns -1 and sets errno on failure.
+pid_t Spawn(const std::vector<std::string>& args, const ProcessOptions& options, const FD (&stdio)[3]) {
+    std::vector<char*> argv;
+    argv.reserve(args.size() + 1);
+    for (const auto& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    /// Later entries override earlier ones with the same name.
+    std::vector<char*> envp;
+    if (options.inherit_env)
+        for (char** e = environ; *e; e++) envp.push_back(*e);
+    for (const auto& var : options.env) {
+        const U64  eq   = var.find('=');
+        const auto name = std::string_view{var}.substr(0, eq);
+        std::erase_if(envp, [&](const char* e) { return std::string_view{e}.starts_with(name) && e[name.size()] == '='; });
+        if (eq != std::string::npos) envp.push_back(const_cast<char*>(var.c_str()));
+    }
+    envp.push_back(nullptr);
+
+    const char* cwd = options.cwd.empty() ? nullptr : options.cwd.c_str();
+    return _libutils_spawn(argv[0], argv.data(), envp.data(), cwd, stdio, options.close_fds);
+}
+
+/// Wait for a child to exit; returns false and sets errno on failure.
+bool WaitFor(pid_t pid, ExitStatus& status) {
+    int wstatus{};
+    while (waitpid(pid, &wstatus, 0) < 0)
+        if (errno != EINTR) return false;
+
+    status = {};
+    if (WIFEXITED(wstatus)) status.code = WEXITSTATUS(wstatus);
+    else if (WIFSIGNALED(wstatus)) status.signal = WTERMSIG(wstatus);
+    return true;
+}
+} // namespace
+
+Process::Process(const std::vector<std::string>& args, const ProcessOptions& options, _err_handler_t handler)
+    : err_handler(std::move(handler)) {
+    if (args.empty()) {
+        err_handler("Process: no program to run");
+        return;
+    }
+
+    PipeFDs p_in, p_out, p_err;
+    if (!p_in.Open() || !p_out.Open() || !p_err.Open()) {
+        err_handler(std::string{"pipe2(): "} + std::strerror(errno));
+        return;
+    }
+
+    pid = Spawn(args, options, {p_in.fds[0], p_out.fds[1], p_err.fds[1]});
+    if (pid < 0) {
+        err_handler(args[0] + ": " + std::strerror(errno));
+        return;
+    }
+
+    in  = p_in.Take(1);
+    out = p_out.Take(0);
+    err = p_err.Take(0);
+
+    /// Don't let a child that isn't reading its input block us.
+    fcntl(in, F_SETFL, fcntl(in, F_GETFL) | O_NONBLOCK);
+    fcntl(out, F_SETPIPE_SZ, PipeSize);
+    buffer = std::make_unique_for_overwrite<char[]>(2 * BufferSize);
+}
+
+Process::Process(Process&& other) noexcept
+    : pid(std::exchange(other.pid, -1)),
+      in(std::exchange(other.in, -1)),
+      out(std::exchange(other.out, -1)),
+      err(std::exchange(other.err, -1)),
+      exit_status(std::exchange(other.exit_status, std::nullopt)),
+      buffer(std::move(other.buffer)),
+      err_handler(std::move(other.err_handler)) {}
+
+Process& Process::operator=(Process&& other) noexcept {
+    if (this == &other) return *this;
+    if (pid > 0 && !exit_status) Wait();
+    CloseAll();
+    pid         = std::exchange(other.pid, -1);
+    in          = std::exchange(other.in, -1);
+    out         = std::exchange(other.out, -1);
+    err         = std::exchange(other.err, -1);
+    exit_status = std::exchange(other.exit_status, std::nullopt);
+    buffer      = std::move(other.buffer);
+    err_handler = std::move(other.err_handler);
+    return *this;
+}
+
+Process::~Process() {
+    /// Closing the pipes first means that a child that is still reading
+    /// its input sees EOF, and one that is still writing gets SIGPIPE.
+    CloseAll();
+    if (pid > 0 && !exit_status) Wait();
+}
+
+void Process::CloseInput() { CloseFD(in); }
+
+U64 Process::PollFDs(std::string_view input, pollfd* fds) {
+    if (in != -1 && input.empty()) CloseInput();
+
+    U64 n = 0;
+    if (out != -1) fds[n++] = {out, POLLIN, 0};
+    if (err != -1) fds[n++] = {err, POLLIN, 0};
+    if (in != -1) fds[n++] = {in, POLLOUT, 0};
+    return n;
+}
+
+void Process::CloseAll() {
+    CloseInput();
+    CloseFD(out);
+    CloseFD(err);
+}
+
+bool Process::Poll(std::string_view& input, const std::function<void(Pipe, std::string_view)>& handler) {
+    pollfd    fds[3];
+    const U64 n = PollFDs(input, fds);
+    if (!n) return false;
+
+    if (poll(fds, n, -1) < 0) {
+        if (errno == EINTR) return true;
+        err_handler(std::string{"poll(): "} + std::strerror(errno));
+        CloseAll();
+        return false;
+    }
+
+    return Service(fds, n, input, handler);
+}
+
+bool Process::Service(const pollfd* fds, U64 n, std::string_view& input, const std::function<void(Pipe, std::string_view)>& handler) {
+    for (U64 i = 0; i < n; i++) {
+        if (!fds[i].revents) continue;
+        if (fds[i].fd == in) {
+            const I64 n_written = WriteNoSigpipe(in, input);
+            if (n_written >= 0) input.remove_prefix(U64(n_written));
+
+            /// EPIPE just means the child doesn't want any more input.
+            else if (errno == EPIPE) input = {};
+            else if (errno != EAGAIN) {
+                err_handler(std::string{"write(): "} + std::strerror(errno));
+                input = {};
+            }
+            if (input.empty()) CloseInput();
+            continue;
+        }
+
+        /// stdout and stderr get separate halves of the buffer so that
+        /// Output() can yield both before either is overwritten.
+        const Pipe pipe   = fds[i].fd == out ? Pipe::Stdout : Pipe::Stderr;
+        FD&        fd     = pipe == Pipe::Stdout ? out : err;
+        char*      buf    = buffer.get() + (pipe == Pipe::Stdout ? 0 : BufferSize);
+        const I64  n_read = read(fd, buf, BufferSize);
+        if (n_read > 0) handler(pipe, {buf, U64(n_read)});
+        else if (n_read == 0) CloseFD(fd);
+        else if (errno != EINTR && errno != EAGAIN) {
+            err_handler(std::string{"read(): "} + std::strerror(errno));
+            CloseFD(fd);
+        }
+    }
+
+    return in != -1 || out != -1 || err != -1;
+}
+
+void Process::Communicate(std::string_view input, const OutputHandler& on_stdout, const OutputHandler& on_stderr) {
+    const auto handler = [&](Pipe pipe, std::string_view data) {
+        const auto& h = pipe == Pipe::Stdout ? on_stdout : on_stderr;
+        if (h) h(data);
+    };
+    while (Poll(input, handler));
+}
+
+co_generator<Process::Chunk> Process::Output(std::string_view input) {
+    std::vector<Chunk> chunks;
+    const auto         handler = [&](Pipe pipe, std::string_view data) { chunks.push_back({pipe, data}); };
+    for (bool open = true; open;) {
+        chunks.clear();
+        open = Poll(input, handler);
+        for (const auto& c : chunks) co_yield c;
+    }
+}
+
+ExitStatus Process::Wait() {
+    if (exit_status) return *exit_status;
+    if (pid <= 0) return {};
+
+    CloseAll();
+
+    ExitStatus status;
+    if (!WaitFor(pid, status)) {
+        err_handler(std::string{"waitpid(): "} + std::strerror(errno));
+        return {};
+    }
+    exit_status = status;
+    return status;
+}
+
+bool Process::Kill(int signal) {
+    if (pid <= 0 || exit_status) return false;
+    return kill(pid, signal) == 0;
+}
+
+Process Process::Shell(const std::string& command, const ProcessOptions& options, _err_handler_t handler) {
+    return Process{{"/bin/bash", "-c", command}, options, std::move(handler)};
+}
+
+Process::Result Process::Collect(Process proc, std::string_view input) {
+    Result result;
+    if (!proc.Valid()) return result;
+    proc.Communicate(
+        input,
+        [&](std::string_view data) { result.out += data; },
+        [&](std::string_view data) { result.err += data; });
+    result.status = proc.Wait();
+    return result;
+}
+
+Process::Result Process::Run(const std::vector<std::string>& argv, std::string_view input, const ProcessOptions& options, _err_handler_t handler) {
+    return Collect(Process{argv, options, std::move(handler)}, input);
+}
+
+Process::Result Process::RunShell(const std::string& command, std::string_view input, const ProcessOptions& options, _err_handler_t handler) {
+    return Collect(Shell(command, options, std::move(handler)), input);
+}
+
+std::optional<Process::MappedResult> Process::RunMapped(const std::vector<std::string>& argv, std::string_view input, const ProcessOptions& options, _err_handler_t handler) {
+    if (argv.empty()) {
+        handler("Process: no program to run");
+        return std::nullopt;
+    }
+
+    /// Memory files behave like regular files, so the child can write
+    /// to them as fast as it likes, and we can map them afterwards.
+    FD         fds[3] = {memfd_create("stdin", MFD_CLOEXEC), memfd_create("stdout", MFD_CLOEXEC), memfd_create("stderr", MFD_CLOEXEC)};
+    const auto CloseFDs = [&] {
+        for (FD& fd : fds) CloseFD(fd);
+    };
+    if (fds[0] < 0 || fds[1] < 0 || fds[2] < 0) {
+        handler(std::string{"memfd_create(): "} + std::strerror(errno));
+        CloseFDs();
+        return std::nullopt;
+    }
+
+    /// The child shares the file offset with us, so rewind after writing the input.
+    iovec iov{const_cast<char*>(input.data()), input.size()};
+    if (!_libutils_write_all(fds[0], &iov, 1, handler) || lseek(fds[0], 0, SEEK_SET) < 0) {
+        CloseFDs();
+        return std::nullopt;
+    }
+
+    const pid_t pid = Spawn(argv, options, fds);
+    if (pid < 0) {
+        handler(argv[0] + ": " + std::strerror(errno));
+        CloseFDs();
+        return std::nullopt;
+    }
+
+    ExitStatus status;
+    if (!WaitFor(pid, status)) {
+        handler(std::string{"waitpid(): "} + std::strerror(errno));
+        CloseFDs();
+        return std::nullopt;
+    }
+
+    MappedResult result{MappedFile<>{fds[1], {}, handler}, MappedFile<>{fds[2], {}, handler}, status};
+    CloseFDs();
+    return result;
+}
+
+ProcessPool::ProcessPool(U64 _max_parallel, _err_handler_t handler)
+    : max_parallel(_max_parallel ? _max_parallel : std::max(1U, std::thread::hardware_concurrency())),
+      err_handler(std::move(handler)) {}
+
+U64 ProcessPool::Submit(Job job) {
+    jobs.push_back(std::move(job));
+    return jobs.size() - 1;
+}
+
+U64 ProcessPool::SubmitShell(const std::string& command, std::string input, ProcessOptions options) {
+    return Submit({{"/bin/bash", "-c", command}, std::move(input), std::move(options)});
+}
+
+void ProcessPool::Run(const CompletionHandler& on_complete, Order order) {
+    struct Running {
+        U64              index;
+        Process          proc;
+        std::string_view input;
+        Process::Result  result;
+    };
+
+    /// Keep the jobs alive until we're done since we don't copy their input.
+    const auto batch = std::move(jobs);
+    jobs.clear();
+
+    std::vector<std::optional<Process::Result>> finished;
+    U64                                         next_delivery = 0;
+    if (order == Order::Submission) finished.resize(batch.size());
+    const auto Deliver = [&](U64 index, Process::Result&& result) {
+        if (order == Order::Completion) return on_complete(index, std::move(result));
+        finished[index] = std::move(result);
+        for (; next_delivery < finished.size() && finished[next_delivery]; next_delivery++) {
+            on_complete(next_delivery, std::move(*finished[next_delivery]));
+            finished[next_delivery].reset();
+        }
+    };
+
+    std::vector<Running> running;
+    std::vector<pollfd>  fds;
+    std::vector<U64>     counts;
+    running.reserve(std::min(max_parallel, batch.size()));
+    for (U64 next_start = 0;;) {
+        while (running.size() < max_parallel && next_start < batch.size()) {
+            const U64   index = next_start++;
+            const auto& job   = batch[index];
+            Process     proc{job.argv, job.options, err_handler};
+            if (!proc.Valid()) Deliver(index, {});
+            else running.push_back({index, std::move(proc), job.input, {}});
+        }
+        if (running.empty()) break;
+
+        /// Wait for all of the running processes' pipes at once.
+        fds.resize(running.size() * 3);
+        counts.resize(running.size());
+        U64 total = 0;
+        for (U64 i = 0; i < running.size(); i++) {
+            counts[i] = running[i].proc.PollFDs(running[i].input, fds.data() + total);
+            total += counts[i];
+        }
+
+        if (total && poll(fds.data(), total, -1) < 0) {
+            if (errno == EINTR) continue;
+            err_handler(std::string{"poll(): "} + std::strerror(errno));
+            for (auto& r : running) r.proc.CloseAll();
+            counts.assign(running.size(), 0);
+        }
+
+        /// Service every process, then collect the ones that are done.
+        U64 offset = 0;
+        for (U64 i = 0; i < running.size(); i++) {
+            auto&      r       = running[i];
+            const auto capture = [&](Process::Pipe pipe, std::string_view data) {
+                (pipe == Process::Pipe::Stdout ? r.result.out : r.result.err) += data;
+            };
+            const bool open = counts[i] && r.proc.Service(fds.data() + offset, counts[i], r.input, capture);
+            offset += counts[i];
+            if (!open) counts[i] = ~U64(0);
+        }
+
+        for (U64 i = running.size(); i--;) {
+            if (counts[i] != ~U64(0)) continue;
+            auto& r         = running[i];
+            r.result.status = r.proc.Wait();
+            Deliver(r.index, std::move(r.result));
+            running.erase(running.begin() + I64(i));
+        }
+    }
+}
+
+std::vector<Process::Result> ProcessPool::Run() {
+    std::vector<Process::Result> results(jobs.size());
+    Run([&](U64 index, Process::Result&& result) { results[index] = std::move(result); });
+    return results;
+}
+
+std::vector<Process::Result> RunAll(const std::vector<std::vector<std::string>>& commands, U64 max_parallel, _err_handler_t handler) {
+    ProcessPool pool{max_parallel, std::move(handler)};
+    for (const auto& argv : commands) pool.Submit({argv, {}, {}});
+    return pool.Run();
+}
+
+Coprocess::Coprocess(std::vector<std::string> _argv, Framing _framing, ProcessOptions _options, _err_handler_t handler)
+    : argv(std::move(_argv)),
+      options(std::move(_options)),
+      framing(_framing),
+      proc(argv, options, handler),
+      err_handler(std::move(handler)) {
+    read_buffer.resize(64 * 1024);
+}
+
+void Coprocess::Restart() {
+    /// The child may be stuck rather than dead, so don't wait for it politely.
+    proc.Kill(SIGKILL);
+    proc        = Process{argv, options, err_handler};
+    read_start  = read_scan = read_end = 0;
+    restarts++;
+}
+
+bool Coprocess::ParseResponse(std::string_view& response) {
+    const char* data = read_buffer.data();
+    if (framing == Framing::Line) {
+        const void* nl = std::memchr(data + read_scan, '\n', read_end - read_scan);
+        if (!nl) {
+            read_scan = read_end;
+            return false;
+        }
+        const U64 pos = U64(static_cast<const char*>(nl) - data);
+        response      = {data + read_start, pos - read_start};
+        read_start = read_scan = pos + 1;
+        return true;
+    }
+
+    U32 length;
+    if (read_end - read_start < sizeof length) return false;
+    std::memcpy(&length, data + read_start, sizeof length);
+    if constexpr (std::endian::native == std::endian::big) length = std::byteswap(length);
+    if (read_end - read_start - sizeof length < length) return false;
+    response   = {data + read_start + sizeof length, length};
+    read_start = read_scan = read_start + sizeof length + length;
+    return true;
+}
+
+bool Coprocess::Exchange(std::string_view request, std::string_view& response) {
+    write_buffer.clear();
+    if (framing == Framing::Length) {
+        U32 length = U32(request.size());
+        if constexpr (std::endian::native == std::endian::big) length = std::byteswap(length);
+        write_buffer.append(reinterpret_cast<const char*>(&length), sizeof length);
+    }
+    write_buffer += request;
+    if (framing == Framing::Line && !request.ends_with('\n')) write_buffer += '\n';
+
+    /// The previous response is no longer needed, so make room for this one.
+    if (read_start) {
+        std::memmove(read_buffer.data(), read_buffer.data() + read_start, read_end - read_start);
+        read_end -= read_start;
+        read_scan -= read_start;
+        read_start = 0;
+    }
+
+    /// Keep reading while writing so that a child that starts responding
+    /// before it has read the entire request can't deadlock us.
+    std::string_view pending = write_buffer;
+    for (;;) {
+        if (pending.empty() && ParseResponse(response)) return true;
+
+        pollfd fds[3];
+        nfds_t n = 0;
+        if (proc.out == -1) return false;
+        fds[n++] = {proc.out, POLLIN, 0};
+        if (proc.err != -1) fds[n++] = {proc.err, POLLIN, 0};
+        if (!pending.empty()) fds[n++] = {proc.in, POLLOUT, 0};
+        if (poll(fds, n, -1) < 0) {
+            if (errno == EINTR) continue;
+            err_handler(std::string{"poll(): "} + std::strerror(errno));
+            return false;
+        }
+
+        for (nfds_t i = 0; i < n; i++) {
+            if (!fds[i].revents) continue;
+            if (fds[i].fd == proc.in) {
+                const I64 n_written = WriteNoSigpipe(proc.in, pending);
+                if (n_written >= 0) pending.remove_prefix(U64(n_written));
+                else if (errno != EAGAIN) return false;
+            } else if (fds[i].fd == proc.err) {
+                /// Only keep the end of stderr; that's where the interesting part usually is.
+                static constexpr U64 MaxStderr = 64 * 1024;
+                char                 buf[4096];
+                const I64            n_read = read(proc.err, buf, sizeof buf);
+                if (n_read == 0) CloseFD(proc.err);
+                if (n_read <= 0) continue;
+                stderr_tail.append(buf, U64(n_read));
+                if (stderr_tail.size() > MaxStderr) stderr_tail.erase(0, stderr_tail.size() - MaxStderr);
+            } else {
+                if (read_end == read_buffer.size()) read_buffer.resize(read_buffer.size() * 2);
+                const I64 n_read = read(proc.out, read_buffer.data() + read_end, read_buffer.size() - read_end);
+                if (n_read == 0) return false;
+                if (n_read < 0 && errno != EINTR && errno != EAGAIN) return false;
+                if (n_read > 0) read_end += U64(n_read);
+            }
+        }
+    }
+}
+
+std::optional<std::string_view> Coprocess::Request(std::string_view request) {
+    if (framing == Framing::Length && request.size() > UINT32_MAX) {
+        err_handler("Coprocess: request is too large for length framing");
+        return std::nullopt;
+    }
+
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (attempt) Restart();
+        if (!proc.Valid()) continue;
+        std::string_view response;
+        if (Exchange(request, response)) return response;
+    }
+    return std::nullopt;
+}
+
+CoprocessPool::CoprocessPool(
+    U64                      size,
+    std::vector<std::string> argv,
+    Coprocess::Framing       framing,
+    ProcessOptions           options,
+    _err_handler_t           handler
+) {
+    if (!size) size = std::max(1U, std::thread::hardware_concurrency());
+    for (U64 i = 0; i < size; i++) {
+        coprocesses.push_back(std::make_unique<Coprocess>(argv, framing, options, handler));
+        idle.push_back(coprocesses.back().get());
+    }
+}
+
+void CoprocessPool::Release(Coprocess* co) {
+    {
+        std::unique_lock lock{mutex};
+        idle.push_back(co);
+    }
+    available.notify_one();
+}
+
+CoprocessPool::Lease CoprocessPool::Acquire() {
+    std::unique_lock lock{mutex};
+    available.wait(lock, [this] { return !idle.empty(); });
+    Coprocess* co = idle.back();
+    idle.pop_back();
+    return {this, co};
+}
+
+std::optional<std::string> CoprocessPool::Request(std::string_view request) {
+    auto lease    = Acquire();
+    auto response = lease->Request(request);
+    if (!response) return std::nullopt;
+    return std::string{*response};
+}
@@ -0,0 +1,207 @@
+#ifndef UTILS_SIMD_H
+#define UTILS_SIMD_H
+
+#include "../include/utils.h"
+
+#include <bit>
+
+#if defined(__x86_64__) || defined(__i386__)
+#    define LIBUTILS_X86 1
+#    include <immintrin.h>
+#else
+#    define LIBUTILS_X86 0
+#endif
+
+#ifdef __SSE2__
+#    define LIBUTILS_SSE2 1
+#else
+#    define LIBUTILS_SSE2 0
+#endif
+
+/// Functions that use AVX2 intrinsics are compiled for AVX2 individually and
+/// only ever called after checking for AVX2 support at runtime, so that the
+/// library itself can still be built for baseline x86-64.
+#define LIBUTILS_TARGET_AVX2  gnu::target("avx2")
+#define LIBUTILS_TARGET_SSSE3 gnu::target("ssse3")
+
+LIBUTILS_NAMESPACE_BEGIN
+namespace simd {
+
+/// Whether the CPU we're running on supports AVX2. The result is cached.
+inline bool HasAVX2() {
+#if LIBUTILS_X86
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+#else
+    return false;
+#endif
+}
+
+/// Whether the CPU we're running on supports SSSE3. The result is cached.
+inline bool HasSSSE3() {
+#if LIBUTILS_X86
+    static const bool has_ssse3 = __builtin_cpu_supports("ssse3");
+    return has_ssse3;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Lane-width-generic comparison primitives.
+ *
+ * T is the element type of the buffer that is being scanned and must be
+ * either 1 or 4 bytes wide. Every primitive returns a vector in which each
+ * lane is all ones if the predicate holds for that lane and zero otherwise.
+ */
+#if LIBUTILS_SSE2
+template <typename T>
+inline __m128i Eq(__m128i v, T c) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 4, "Unsupported lane width");
+    if constexpr (sizeof(T) == 1) return _mm_cmpeq_epi8(v, _mm_set1_epi8(char(c)));
+    else return _mm_cmpeq_epi32(v, _mm_set1_epi32(int(c)));
+}
+
+/// Unsigned `lo <= v <= hi'.
+template <typename T>
+inline __m128i InRange(__m128i v, T lo, T hi) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 4, "Unsupported lane width");
+    if constexpr (sizeof(T) == 1) {
+        auto off = _mm_sub_epi8(v, _mm_set1_epi8(char(lo)));
+        return _mm_cmpeq_epi8(_mm_min_epu8(off, _mm_set1_epi8(char(hi - lo))), off);
+    } else {
+        /// SSE2 has no unsigned 32-bit comparison, so flip the sign bits.
+        const auto sign = _mm_set1_epi32(INT32_MIN);
+        auto       off  = _mm_xor_si128(_mm_sub_epi32(v, _mm_set1_epi32(int(lo))), sign);
+        auto       gt   = _mm_cmpgt_epi32(off, _mm_xor_si128(_mm_set1_epi32(int(hi - lo)), sign));
+        return _mm_andnot_si128(gt, _mm_set1_epi32(-1));
+    }
+}
+#endif
+
+#if LIBUTILS_X86
+template <typename T>
+[[LIBUTILS_TARGET_AVX2, gnu::always_inline]] inline __m256i Eq(__m256i v, T c) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 4, "Unsupported lane width");
+    if constexpr (sizeof(T) == 1) return _mm256_cmpeq_epi8(v, _mm256_set1_epi8(char(c)));
+    else return _mm256_cmpeq_epi32(v, _mm256_set1_epi32(int(c)));
+}
+
+template <typename T>
+[[LIBUTILS_TARGET_AVX2, gnu::always_inline]] inline __m256i InRange(__m256i v, T lo, T hi) {
+    static_assert(sizeof(T) == 1 || sizeof(T) == 4, "Unsupported lane width");
+    if constexpr (sizeof(T) == 1) {
+        auto off = _mm256_sub_epi8(v, _mm256_set1_epi8(char(lo)));
+        return _mm256_cmpeq_epi8(_mm256_min_epu8(off, _mm256_set1_epi8(char(hi - lo))), off);
+    } else {
+        auto off = _mm256_sub_epi32(v, _mm256_set1_epi32(int(lo)));
+        return _mm256_cmpeq_epi32(_mm256_min_epu32(off, _mm256_set1_epi32(int(hi - lo))), off);
+    }
+}
+#endif
+
+/*
+ * Block scanners.
+ *
+ * A Matcher is a struct with three (possibly static) member functions:
+ *   - `bool Scalar(T c)',          which tests a single element,
+ *   - `__m128i Block<T>(__m128i)', which tests 16 bytes worth of elements,
+ *   - `__m256i Block<T>(__m256i)', which tests 32 bytes worth of elements
+ *                                  and must be marked LIBUTILS_TARGET_AVX2.
+ * The vector versions return a lane mask as produced by Eq() or InRange().
+ * Stateless matchers can be omitted from the argument list.
+ */
+template <typename Matcher, typename T>
+U64 FindFirstScalar(const T* data, U64 n, const Matcher& matcher = {}) {
+    for (U64 i = 0; i < n; i++)
+        if (matcher.Scalar(data[i])) return i;
+    return n;
+}
+
+template <typename Matcher, typename T>
+U64 CountScalar(const T* data, U64 n, const Matcher& matcher = {}) {
+    U64 count = 0;
+    for (U64 i = 0; i < n; i++) count += matcher.Scalar(data[i]);
+    return count;
+}
+
+#if LIBUTILS_SSE2
+template <typename Matcher, typename T>
+U64 FindFirstSSE2(const T* data, U64 n, const Matcher& matcher = {}) {
+    constexpr U64 lanes = 16 / sizeof(T);
+    U64           i     = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v    = _mm_loadu_si128((const __m128i*) (data + i));
+        auto mask = U32(_mm_movemask_epi8(matcher.template Block<T>(v)));
+        if (mask) return i + U64(std::countr_zero(mask)) / sizeof(T);
+    }
+    return i + FindFirstScalar<Matcher>(data + i, n - i, matcher);
+}
+
+template <typename Matcher, typename T>
+U64 CountSSE2(const T* data, U64 n, const Matcher& matcher = {}) {
+    constexpr U64 lanes = 16 / sizeof(T);
+    U64           i = 0, bits = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v = _mm_loadu_si128((const __m128i*) (data + i));
+        bits += U64(std::popcount(U32(_mm_movemask_epi8(matcher.template Block<T>(v)))));
+    }
+    return bits / sizeof(T) + CountScalar<Matcher>(data + i, n - i, matcher);
+}
+#endif
+
+#if LIBUTILS_X86
+template <typename Matcher, typename T>
+[[LIBUTILS_TARGET_AVX2]] U64 FindFirstAVX2(const T* data, U64 n, const Matcher& matcher = {}) {
+    constexpr U64 lanes = 32 / sizeof(T);
+    U64           i     = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v    = _mm256_loadu_si256((const __m256i*) (data + i));
+        auto mask = U32(_mm256_movemask_epi8(matcher.template Block<T>(v)));
+        if (mask) return i + U64(std::countr_zero(mask)) / sizeof(T);
+    }
+    return i + FindFirstScalar<Matcher>(data + i, n - i, matcher);
+}
+
+template <typename Matcher, typename T>
+[[LIBUTILS_TARGET_AVX2]] U64 CountAVX2(const T* data, U64 n, const Matcher& matcher = {}) {
+    constexpr U64 lanes = 32 / sizeof(T);
+    U64           i = 0, bits = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v = _mm256_loadu_si256((const __m256i*) (data + i));
+        bits += U64(std::popcount(U32(_mm256_movemask_epi8(matcher.template Block<T>(v)))));
+    }
+    return bits / sizeof(T) + CountScalar<Matcher>(data + i, n - i, matcher);
+}
+#endif
+
+/// Index of the first element of `data' that satisfies Matcher, or `n' if there is none.
+template <typename Matcher, typename T>
+U64 FindFirst(const T* data, U64 n, const Matcher& matcher = {}) {
+#if LIBUTILS_X86
+    if (HasAVX2()) return FindFirstAVX2<Matcher>(data, n, matcher);
+#endif
+#if LIBUTILS_SSE2
+    return FindFirstSSE2<Matcher>(data, n, matcher);
+#else
+    return FindFirstScalar<Matcher>(data, n, matcher);
+#endif
+}
+
+/// Number of elements of `data' that satisfy Matcher.
+template <typename Matcher, typename T>
+U64 Count(const T* data, U64 n, const Matcher& matcher = {}) {
+#if LIBUTILS_X86
+    if (HasAVX2()) return CountAVX2<Matcher>(data, n, matcher);
+#endif
+#if LIBUTILS_SSE2
+    return CountSSE2<Matcher>(data, n, matcher);
+#else
+    return CountScalar<Matcher>(data, n, matcher);
+#endif
+}
+
+} // namespace simd
+LIBUTILS_NAMESPACE_END
+
+#endif // UTILS_SIMD_H
@@ -6,9 +6,11 @@ const green = "\033[0;32m"
 const reset = "\033[00m"
 
 let arg = ""
+let case_table = false
+const options = "XID_START, XID_CONTINUE, SIMPLE_LOWERCASE, SIMPLE_UPPERCASE, or SIMPLE_CASE_FOLDING"
 
 if (argv.length < 3) {
-	process.stderr.write("Error: missing argument. Please specify either XID_START or XID_CONTINUE.\n");
+	process.stderr.write(`Error: missing argument. Please specify ${options}.\n`);
 	exit(1);
 }
 switch (argv[2].split(" ").join("")) {
@@ -20,11 +22,72 @@ switch (argv[2].split(" ").join("")) {
 		arg = "XID_CONTINUE"
 		process.stdout.write(`${yellow}Generating XID_CONTINUE.c...\n`)
 		break
+	case "SIMPLE_LOWERCASE":
+	case "SIMPLE_UPPERCASE":
+	case "SIMPLE_CASE_FOLDING":
+		arg = argv[2].split(" ").join("")
+		case_table = true
+		process.stdout.write(`${green}Generating ${arg}.c...\n`)
+		break
 	default:
-		process.stderr.write(`Error: unrecognised option '${argv[2]}'. Please specify XID_START or XID_CONTINUE.\n`);
+		process.stderr.write(`Error: unrecognised option '${argv[2]}'. Please specify ${options}.\n`);
 		exit(1);
 }
 
+// Case mappings are stored as a two-stage table of deltas: the code point
+// shifted right by 7 indexes the first stage, which yields a block of 128
+// deltas in the second stage. Identical blocks are only stored once, so all
+// blocks without any mappings share block 0.
+function build_case_table() {
+	const block_size = 128
+
+	let deltas = new Map()
+	let max = 0
+	for (let line of fs.readFileSync(`${arg}.txt`).toString().split("\n")) {
+		line = line.slice(0, line.indexOf("#") < 0 ? line.length : line.indexOf("#")).split(" ").join("")
+		if (line.length === 0) continue
+		const fields = line.split(";")
+		const from = Number("0x" + fields[0])
+		const to = Number("0x" + fields[1])
+		deltas.set(from, to - from)
+		if (from > max) max = from
+		process.stdout.write("\rIndexing code points: " + deltas.size.toString())
+	}
+	process.stdout.write("\n")
+
+	const empty = new Array(block_size).fill(0)
+	let stage1 = []
+	let stage2 = [...empty]
+	let blocks = new Map([[empty.join(","), 0]])
+	const n_blocks = Math.floor(max / block_size) + 1
+	for (let b = 0; b < n_blocks; b++) {
+		let block = []
+		for (let i = 0; i < block_size; i++) block.push(deltas.get(b * block_size + i) ?? 0)
+		const key = block.join(",")
+		if (!blocks.has(key)) {
+			blocks.set(key, blocks.size)
+			stage2.push(...block)
+		}
+		stage1.push(blocks.get(key))
+		process.stdout.write("\rGenerating lookup table: " + b.toString())
+	}
+
+	let out = `#define MAX_${arg} (0x${max.toString(16).toUpperCase()})\n`
+	out += `#define ${arg}_BLOCK_SHIFT (7)\n\n// clang-format off\n`
+	out += `static const unsigned short ${arg}_STAGE1[] = { // ${stage1.length}\n`
+	for (let i = 0; i < stage1.length; i++) out += stage1[i] + ((i + 1) % 32 == 0 ? ",\n" : ", ")
+	out += `\n};\n\nstatic const int ${arg}_STAGE2[] = { // ${stage2.length}\n`
+	for (let i = 0; i < stage2.length; i++) out += stage2[i] + ((i + 1) % 32 == 0 ? ",\n" : ", ")
+	out += "\n};\n// clang-format on\n"
+	fs.writeFileSync(`${arg}.c`, out)
+}
+
+if (case_table) {
+	build_case_table()
+	process.stdout.write(`${reset}\n`)
+	exit(0)
+}
+
 let rawdata = fs.readFileSync(`${arg}.txt`).toString().split("\n")
 for (let line in rawdata) rawdata[line] = rawdata[line].slice(0, rawdata[line].indexOf(";")).split(" ").join("")
 
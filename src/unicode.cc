@@ -1,6 +1,15 @@
-#include "../include/utils.h"
+#include "../include/unicode-utils.h"
+
+#include "./simd.h"
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
 
 extern "C" {
+#include "./unicode-tables/SIMPLE_CASE_FOLDING.c"
+#include "./unicode-tables/SIMPLE_LOWERCASE.c"
+#include "./unicode-tables/SIMPLE_UPPERCASE.c"
 #include "./unicode-tables/XID_CONTINUE.c"
 #include "./unicode-tables/XID_START.c"
 }
@@ -14,4 +23,841 @@ unsigned char iscontinue(int c) {
     return c > MAX_XID_CONTINUE ? 0 : (XID_CONTINUE_TABLE[(c & ~0b111) >> 3] >> (c & 0b111)) & 1;
 }
 
-LIBUTILS_NAMESPACE_END
\ No newline at end of file
+namespace {
+enum struct CaseMapping {
+    Lower,
+    Upper,
+    Fold,
+};
+
+/// Look up a character in one of the generated two-stage case tables.
+template <CaseMapping mapping>
+Char MapCase(Char c) {
+    if (c < 0x80) {
+        if constexpr (mapping == CaseMapping::Upper) return c >= 'a' && c <= 'z' ? c ^ 0x20 : c;
+        else return c >= 'A' && c <= 'Z' ? c ^ 0x20 : c;
+    }
+
+    const unsigned short* stage1;
+    const int*            stage2;
+    U32                   shift;
+    if constexpr (mapping == CaseMapping::Lower) {
+        if (c > MAX_SIMPLE_LOWERCASE) return c;
+        stage1 = SIMPLE_LOWERCASE_STAGE1;
+        stage2 = SIMPLE_LOWERCASE_STAGE2;
+        shift  = SIMPLE_LOWERCASE_BLOCK_SHIFT;
+    } else if constexpr (mapping == CaseMapping::Upper) {
+        if (c > MAX_SIMPLE_UPPERCASE) return c;
+        stage1 = SIMPLE_UPPERCASE_STAGE1;
+        stage2 = SIMPLE_UPPERCASE_STAGE2;
+        shift  = SIMPLE_UPPERCASE_BLOCK_SHIFT;
+    } else {
+        if (c > MAX_SIMPLE_CASE_FOLDING) return c;
+        stage1 = SIMPLE_CASE_FOLDING_STAGE1;
+        stage2 = SIMPLE_CASE_FOLDING_STAGE2;
+        shift  = SIMPLE_CASE_FOLDING_BLOCK_SHIFT;
+    }
+
+    const Char mask  = (Char(1) << shift) - 1;
+    const U64  block = U64(stage1[c >> shift]) << shift;
+    return Char(I64(c) + stage2[block | (c & mask)]);
+}
+
+/// The first ASCII letter that `mapping' changes.
+template <CaseMapping mapping>
+constexpr char FirstCased = mapping == CaseMapping::Upper ? 'a' : 'A';
+
+/*
+ * Case conversion kernels.
+ *
+ * Flipping bit 5 converts between upper- and lowercase ASCII letters. For
+ * UTF-32, blocks that contain only ASCII are converted that way; other
+ * blocks fall back to the tables one character at a time.
+ */
+template <CaseMapping mapping, typename T>
+void MapCaseScalar(T* data, U64 n) {
+    for (U64 i = 0; i < n; i++) {
+        if constexpr (sizeof(T) == 1) {
+            const char lo = FirstCased<mapping>;
+            if (data[i] >= lo && data[i] <= lo + 25) data[i] ^= 0x20;
+        } else data[i] = MapCase<mapping>(data[i]);
+    }
+}
+
+#if LIBUTILS_SSE2
+template <CaseMapping mapping, typename T>
+void MapCaseSSE2(T* data, U64 n) {
+    constexpr U64 lanes = 16 / sizeof(T);
+    const T       lo    = T(FirstCased<mapping>);
+    const auto    flip  = sizeof(T) == 1 ? _mm_set1_epi8(0x20) : _mm_set1_epi32(0x20);
+    const auto    high  = sizeof(T) == 1 ? _mm_setzero_si128() : _mm_set1_epi32(~0x7F);
+    U64           i     = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v = _mm_loadu_si128((const __m128i*) (data + i));
+        if constexpr (sizeof(T) == 4) {
+            if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, high), _mm_setzero_si128())) != 0xFFFF) {
+                MapCaseScalar<mapping>(data + i, lanes);
+                continue;
+            }
+        }
+        v = _mm_xor_si128(v, _mm_and_si128(simd::InRange<T>(v, lo, T(lo + 25)), flip));
+        _mm_storeu_si128((__m128i*) (data + i), v);
+    }
+    MapCaseScalar<mapping>(data + i, n - i);
+}
+#endif
+
+#if LIBUTILS_X86
+template <CaseMapping mapping, typename T>
+[[LIBUTILS_TARGET_AVX2]] void MapCaseAVX2(T* data, U64 n) {
+    constexpr U64 lanes = 32 / sizeof(T);
+    const T       lo    = T(FirstCased<mapping>);
+    const auto    flip  = sizeof(T) == 1 ? _mm256_set1_epi8(0x20) : _mm256_set1_epi32(0x20);
+    const auto    high  = _mm256_set1_epi32(~0x7F);
+    U64           i     = 0;
+    for (; i + lanes <= n; i += lanes) {
+        auto v = _mm256_loadu_si256((const __m256i*) (data + i));
+        if constexpr (sizeof(T) == 4) {
+            if (!_mm256_testz_si256(v, high)) {
+                MapCaseScalar<mapping>(data + i, lanes);
+                continue;
+            }
+        }
+        v = _mm256_xor_si256(v, _mm256_and_si256(simd::InRange<T>(v, lo, T(lo + 25)), flip));
+        _mm256_storeu_si256((__m256i*) (data + i), v);
+    }
+    MapCaseScalar<mapping>(data + i, n - i);
+}
+#endif
+
+template <CaseMapping mapping, typename TString>
+TString MapCase(TString str) {
+#if LIBUTILS_X86
+    if (simd::HasAVX2()) MapCaseAVX2<mapping>(str.data(), str.size());
+    else
+#endif
+#if LIBUTILS_SSE2
+        MapCaseSSE2<mapping>(str.data(), str.size());
+#else
+        MapCaseScalar<mapping>(str.data(), str.size());
+#endif
+    return str;
+}
+
+constexpr Char ReplacementCharacter = 0xFFFD;
+
+/*
+ * ASCII fast paths.
+ *
+ * Both functions convert the longest prefix of `in' that consists only of
+ * ASCII characters and return its length. Blocks of 16 or 32 characters
+ * are checked and converted at once; the remainder is handled by the
+ * scalar loop in the caller, which calls back into these functions as soon
+ * as it encounters the next ASCII character.
+ */
+U64 WidenASCIIScalar(const char* in, U64 n, Char* out) {
+    U64 i = 0;
+    while (i < n && U8(in[i]) < 0x80) {
+        out[i] = Char(U8(in[i]));
+        i++;
+    }
+    return i;
+}
+
+U64 NarrowASCIIScalar(const Char* in, U64 n, char* out) {
+    U64 i = 0;
+    while (i < n && in[i] < 0x80) {
+        out[i] = char(in[i]);
+        i++;
+    }
+    return i;
+}
+
+#if LIBUTILS_SSE2
+U64 WidenASCIISSE2(const char* in, U64 n, Char* out) {
+    const auto zero = _mm_setzero_si128();
+    U64        i    = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto v = _mm_loadu_si128((const __m128i*) (in + i));
+        if (_mm_movemask_epi8(v)) break;
+        auto lo = _mm_unpacklo_epi8(v, zero);
+        auto hi = _mm_unpackhi_epi8(v, zero);
+        _mm_storeu_si128((__m128i*) (out + i), _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*) (out + i + 4), _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128((__m128i*) (out + i + 8), _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128((__m128i*) (out + i + 12), _mm_unpackhi_epi16(hi, zero));
+    }
+    return i + WidenASCIIScalar(in + i, n - i, out + i);
+}
+
+U64 NarrowASCIISSE2(const Char* in, U64 n, char* out) {
+    const auto high = _mm_set1_epi32(~0x7F);
+    U64        i    = 0;
+    for (; i + 16 <= n; i += 16) {
+        auto a = _mm_loadu_si128((const __m128i*) (in + i));
+        auto b = _mm_loadu_si128((const __m128i*) (in + i + 4));
+        auto c = _mm_loadu_si128((const __m128i*) (in + i + 8));
+        auto d = _mm_loadu_si128((const __m128i*) (in + i + 12));
+        auto any = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF) break;
+        auto packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+        _mm_storeu_si128((__m128i*) (out + i), packed);
+    }
+    return i + NarrowASCIIScalar(in + i, n - i, out + i);
+}
+#endif
+
+#if LIBUTILS_X86
+[[LIBUTILS_TARGET_AVX2]] U64 WidenASCIIAVX2(const char* in, U64 n, Char* out) {
+    U64 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        auto v = _mm256_loadu_si256((const __m256i*) (in + i));
+        if (_mm256_movemask_epi8(v)) break;
+        auto lo = _mm256_castsi256_si128(v);
+        auto hi = _mm256_extracti128_si256(v, 1);
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_cvtepu8_epi32(lo));
+        _mm256_storeu_si256((__m256i*) (out + i + 8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+        _mm256_storeu_si256((__m256i*) (out + i + 16), _mm256_cvtepu8_epi32(hi));
+        _mm256_storeu_si256((__m256i*) (out + i + 24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+    }
+    return i + WidenASCIIScalar(in + i, n - i, out + i);
+}
+
+[[LIBUTILS_TARGET_AVX2]] U64 NarrowASCIIAVX2(const Char* in, U64 n, char* out) {
+    const auto high  = _mm256_set1_epi32(~0x7F);
+    const auto order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    U64        i     = 0;
+    for (; i + 32 <= n; i += 32) {
+        auto a = _mm256_loadu_si256((const __m256i*) (in + i));
+        auto b = _mm256_loadu_si256((const __m256i*) (in + i + 8));
+        auto c = _mm256_loadu_si256((const __m256i*) (in + i + 16));
+        auto d = _mm256_loadu_si256((const __m256i*) (in + i + 24));
+        auto any = _mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d));
+        if (!_mm256_testz_si256(any, high)) break;
+
+        /// The packs operate within 128-bit lanes, so restore the order afterwards.
+        auto packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+        _mm256_storeu_si256((__m256i*) (out + i), _mm256_permutevar8x32_epi32(packed, order));
+    }
+    return i + NarrowASCIIScalar(in + i, n - i, out + i);
+}
+#endif
+
+U64 WidenASCII(const char* in, U64 n, Char* out) {
+#if LIBUTILS_X86
+    if (simd::HasAVX2()) return WidenASCIIAVX2(in, n, out);
+#endif
+#if LIBUTILS_SSE2
+    return WidenASCIISSE2(in, n, out);
+#else
+    return WidenASCIIScalar(in, n, out);
+#endif
+}
+
+U64 NarrowASCII(const Char* in, U64 n, char* out) {
+#if LIBUTILS_X86
+    if (simd::HasAVX2()) return NarrowASCIIAVX2(in, n, out);
+#endif
+#if LIBUTILS_SSE2
+    return NarrowASCIISSE2(in, n, out);
+#else
+    return NarrowASCIIScalar(in, n, out);
+#endif
+}
+
+/// Matches code points that take at least `min' bytes to encode in UTF-8.
+template <U32 min>
+struct EncodedLengthMatcher {
+    static bool Scalar(Char c) { return c >= min; }
+
+#if LIBUTILS_SSE2
+    template <typename>
+    static __m128i Block(__m128i v) { return _mm_andnot_si128(simd::InRange<Char>(v, 0, min - 1), _mm_set1_epi32(-1)); }
+#endif
+
+#if LIBUTILS_X86
+    template <typename>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] static __m256i Block(__m256i v) {
+        return _mm256_andnot_si256(simd::InRange<Char>(v, 0, min - 1), _mm256_set1_epi32(-1));
+    }
+#endif
+};
+
+/**
+ * Decode one non-ASCII UTF-8 sequence
+ *
+ * This follows Table 3-7 of the Unicode Standard, so overlong forms,
+ * surrogates, and code points above U+10FFFF are rejected.
+ *
+ * @param in The input; must not be empty
+ * @param n The number of bytes available
+ * @param c Set to the decoded code point on success
+ * @return The length of the sequence on success; otherwise, the negated
+ *         length of the maximal ill-formed subpart (at least 1)
+ */
+I64 DecodeSequence(const U8* in, U64 n, Char& c) {
+    const U8 b0 = in[0];
+    U64      len;
+    U8       lo = 0x80, hi = 0xBF;
+    if (b0 >= 0xC2 && b0 <= 0xDF) {
+        len = 2;
+        c   = b0 & 0x1F;
+    } else if (b0 >= 0xE0 && b0 <= 0xEF) {
+        len = 3;
+        c   = b0 & 0x0F;
+        if (b0 == 0xE0) lo = 0xA0;
+        else if (b0 == 0xED) hi = 0x9F;
+    } else if (b0 >= 0xF0 && b0 <= 0xF4) {
+        len = 4;
+        c   = b0 & 0x07;
+        if (b0 == 0xF0) lo = 0x90;
+        else if (b0 == 0xF4) hi = 0x8F;
+    } else return -1;
+
+    for (U64 i = 1; i < len; i++) {
+        if (i == n || in[i] < lo || in[i] > hi) return -I64(i);
+        c  = (c << 6) | (in[i] & 0x3F);
+        lo = 0x80;
+        hi = 0xBF;
+    }
+    return I64(len);
+}
+
+/// Encode a valid code point that is not ASCII and return the number of bytes written.
+U64 EncodeSequence(Char c, char* out) {
+    if (c < 0x800) {
+        out[0] = char(0xC0 | (c >> 6));
+        out[1] = char(0x80 | (c & 0x3F));
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = char(0xE0 | (c >> 12));
+        out[1] = char(0x80 | ((c >> 6) & 0x3F));
+        out[2] = char(0x80 | (c & 0x3F));
+        return 3;
+    }
+    out[0] = char(0xF0 | (c >> 18));
+    out[1] = char(0x80 | ((c >> 12) & 0x3F));
+    out[2] = char(0x80 | ((c >> 6) & 0x3F));
+    out[3] = char(0x80 | (c & 0x3F));
+    return 4;
+}
+
+/*
+ * UTF-8 validation.
+ *
+ * The vectorised validators implement the lookup algorithm described in
+ * "Validating UTF-8 In Less Than One Instruction Per Byte" by Keiser and
+ * Lemire: three 16-entry tables, indexed by the high and low nibble of each
+ * byte and the high nibble of its successor, classify every pair of adjacent
+ * bytes; the bitwise and of the three classifications is nonzero iff the pair
+ * is invalid. Sequences of three and four bytes are then checked by ensuring
+ * that exactly those positions that must be continuation bytes are ones.
+ *
+ * The vectorised validators only tell us *whether* a block contains an
+ * error. Once they do, we rewind to the start of the sequence that may
+ * straddle the block boundary and let the scalar validator find the exact
+ * offset.
+ */
+constexpr U8 TooShort   = 1 << 0; /// 11______ 0_______ or 11______ 11______
+constexpr U8 TooLong    = 1 << 1; /// 0_______ 10______
+constexpr U8 Overlong3  = 1 << 2; /// 11100000 100_____
+constexpr U8 TooLarge   = 1 << 3; /// 11110100 1001____ and above
+constexpr U8 Surrogate  = 1 << 4; /// 11101101 101_____
+constexpr U8 Overlong2  = 1 << 5; /// 1100000_ 10______
+constexpr U8 Overlong4  = 1 << 6; /// 11110000 1000____ (shares its bit with TooLarge1000)
+constexpr U8 TwoConts   = 1 << 7; /// 10______ 10______
+constexpr U8 TooLarge1k = 1 << 6; /// 11110101 1000____ and above
+constexpr U8 Carry      = TooShort | TooLong | TwoConts;
+
+// clang-format off
+alignas(16) constexpr U8 Byte1High[16] = {
+    TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong, TooLong,
+    TwoConts, TwoConts, TwoConts, TwoConts,
+    TooShort | Overlong2,
+    TooShort,
+    TooShort | Overlong3 | Surrogate,
+    TooShort | TooLarge | TooLarge1k | Overlong4,
+};
+
+alignas(16) constexpr U8 Byte1Low[16] = {
+    Carry | Overlong3 | Overlong2 | Overlong4,
+    Carry | Overlong2,
+    Carry,
+    Carry,
+    Carry | TooLarge,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k | Surrogate,
+    Carry | TooLarge | TooLarge1k,
+    Carry | TooLarge | TooLarge1k,
+};
+
+alignas(16) constexpr U8 Byte2High[16] = {
+    TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort, TooShort,
+    TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge1k | Overlong4,
+    TooLong | Overlong2 | TwoConts | Overlong3 | TooLarge,
+    TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+    TooLong | Overlong2 | TwoConts | Surrogate | TooLarge,
+    TooShort, TooShort, TooShort, TooShort,
+};
+// clang-format on
+
+/// Validate `in' starting at `from' and return the offset of the first error or `n'.
+U64 ValidateUTF8Scalar(const U8* in, U64 from, U64 n) {
+    U64 i = from;
+    while (i < n) {
+        /// Skip ASCII eight bytes at a time.
+        while (i + 8 <= n) {
+            U64 word;
+            std::memcpy(&word, in + i, sizeof word);
+            if (word & 0x8080808080808080) break;
+            i += 8;
+        }
+        if (i == n) break;
+        if (in[i] < 0x80) {
+            i++;
+            continue;
+        }
+
+        Char c{};
+        I64  len = DecodeSequence(in + i, n - i, c);
+        if (len < 0) return i;
+        i += U64(len);
+    }
+    return n;
+}
+
+/// Find the error in a block that the vectorised validator has flagged.
+U64 LocateUTF8Error(const U8* in, U64 block, U64 n) {
+    /// Everything up to three bytes before the block has been fully validated,
+    /// so starting at the first lead byte before that is always safe.
+    U64 start = block < 3 ? 0 : block - 3;
+    while (start > 0 && (in[start] & 0xC0) == 0x80) start--;
+    return ValidateUTF8Scalar(in, start, n);
+}
+
+#if LIBUTILS_X86
+[[LIBUTILS_TARGET_SSSE3]] U64 ValidateUTF8SSSE3(const U8* in, U64 n) {
+    const auto t_byte_1_high = _mm_load_si128((const __m128i*) Byte1High);
+    const auto t_byte_1_low  = _mm_load_si128((const __m128i*) Byte1Low);
+    const auto t_byte_2_high = _mm_load_si128((const __m128i*) Byte2High);
+    const auto nibble        = _mm_set1_epi8(0x0F);
+    const auto incomplete    = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        char(0b11110000 - 1), char(0b11100000 - 1), char(0b11000000 - 1));
+
+    auto prev_input      = _mm_setzero_si128();
+    auto prev_incomplete = _mm_setzero_si128();
+    U8   tail[16]{};
+    for (U64 i = 0; i < n; i += 16) {
+        /// Pad the last block with zeroes, i.e. ASCII.
+        __m128i input;
+        if (i + 16 <= n) input = _mm_loadu_si128((const __m128i*) (in + i));
+        else {
+            std::memcpy(tail, in + i, n - i);
+            input = _mm_loadu_si128((const __m128i*) tail);
+        }
+
+        auto error = prev_incomplete;
+        if (_mm_movemask_epi8(input)) {
+            auto prev1       = _mm_alignr_epi8(input, prev_input, 15);
+            auto byte_1_high = _mm_shuffle_epi8(t_byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+            auto byte_1_low  = _mm_shuffle_epi8(t_byte_1_low, _mm_and_si128(prev1, nibble));
+            auto byte_2_high = _mm_shuffle_epi8(t_byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+            auto special     = _mm_and_si128(_mm_and_si128(byte_1_high, byte_1_low), byte_2_high);
+
+            auto prev2       = _mm_alignr_epi8(input, prev_input, 14);
+            auto prev3       = _mm_alignr_epi8(input, prev_input, 13);
+            auto third_byte  = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0b11100000 - 0x80)));
+            auto fourth_byte = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0b11110000 - 0x80)));
+            auto must_be_23  = _mm_and_si128(_mm_or_si128(third_byte, fourth_byte), _mm_set1_epi8(char(0x80)));
+
+            error           = _mm_xor_si128(must_be_23, special);
+            prev_incomplete = _mm_subs_epu8(input, incomplete);
+        } else {
+            prev_incomplete = _mm_setzero_si128();
+        }
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) return LocateUTF8Error(in, i, n);
+        prev_input = input;
+    }
+
+    /// The input may end in the middle of a sequence.
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(prev_incomplete, _mm_setzero_si128())) != 0xFFFF) return LocateUTF8Error(in, n, n);
+    return n;
+}
+
+[[LIBUTILS_TARGET_AVX2]] U64 ValidateUTF8AVX2(const U8* in, U64 n) {
+    const auto t_byte_1_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) Byte1High));
+    const auto t_byte_1_low  = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) Byte1Low));
+    const auto t_byte_2_high = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*) Byte2High));
+    const auto nibble        = _mm256_set1_epi8(0x0F);
+    const auto incomplete    = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        char(0b11110000 - 1), char(0b11100000 - 1), char(0b11000000 - 1));
+
+    auto prev_input      = _mm256_setzero_si256();
+    auto prev_incomplete = _mm256_setzero_si256();
+    U8   tail[32]{};
+    for (U64 i = 0; i < n; i += 32) {
+        __m256i input;
+        if (i + 32 <= n) input = _mm256_loadu_si256((const __m256i*) (in + i));
+        else {
+            std::memcpy(tail, in + i, n - i);
+            input = _mm256_loadu_si256((const __m256i*) tail);
+        }
+
+        auto error = prev_incomplete;
+        if (_mm256_movemask_epi8(input)) {
+            /// Shifting across the 128-bit lanes requires combining the upper
+            /// half of the previous block with the lower half of this one.
+            auto carried     = _mm256_permute2x128_si256(prev_input, input, 0x21);
+            auto prev1       = _mm256_alignr_epi8(input, carried, 15);
+            auto byte_1_high = _mm256_shuffle_epi8(t_byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+            auto byte_1_low  = _mm256_shuffle_epi8(t_byte_1_low, _mm256_and_si256(prev1, nibble));
+            auto byte_2_high = _mm256_shuffle_epi8(t_byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+            auto special     = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+            auto prev2       = _mm256_alignr_epi8(input, carried, 14);
+            auto prev3       = _mm256_alignr_epi8(input, carried, 13);
+            auto third_byte  = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0b11100000 - 0x80)));
+            auto fourth_byte = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0b11110000 - 0x80)));
+            auto must_be_23  = _mm256_and_si256(_mm256_or_si256(third_byte, fourth_byte), _mm256_set1_epi8(char(0x80)));
+
+            error           = _mm256_xor_si256(must_be_23, special);
+            prev_incomplete = _mm256_subs_epu8(input, incomplete);
+        } else {
+            prev_incomplete = _mm256_setzero_si256();
+        }
+
+        if (!_mm256_testz_si256(error, error)) return LocateUTF8Error(in, i, n);
+        prev_input = input;
+    }
+
+    /// The input may end in the middle of a sequence.
+    if (!_mm256_testz_si256(prev_incomplete, prev_incomplete)) return LocateUTF8Error(in, n, n);
+    return n;
+}
+#endif
+
+/*
+ * Multibyte fast paths.
+ *
+ * Text in most scripts consists only of one-, two- and three-byte sequences.
+ * These kernels transcode a block of such sequences at once; a block that
+ * contains anything else, including ill-formed input, is left to the scalar
+ * code, which also determines the exact location of any error.
+ */
+#if LIBUTILS_X86
+/// For each 8-bit mask, the indices of its set bits in ascending order, for
+/// compacting the lanes of a vector with _mm256_permutevar8x32_epi32().
+constexpr auto CompactLanes = [] {
+    std::array<std::array<U32, 8>, 256> table{};
+    for (U32 mask = 0; mask < 256; mask++) {
+        U32 n = 0;
+        for (U32 lane = 0; lane < 8; lane++)
+            if (mask & (1 << lane)) table[mask][n++] = lane;
+    }
+    return table;
+}();
+
+/// A shuffle that packs the UTF-8 encodings of four code points, each stored
+/// in the low bytes of a 32-bit lane, and the total length of the encodings.
+struct PackEncoded {
+    alignas(16) U8 shuffle[16];
+    U8 length;
+};
+
+/// Indexed by the masks of the lanes that need at least two bytes (low
+/// nibble) and at least three bytes (high nibble).
+constexpr auto PackTable = [] {
+    std::array<PackEncoded, 256> table{};
+    for (U32 index = 0; index < 256; index++) {
+        U8 n = 0;
+        for (U32 lane = 0; lane < 4; lane++) {
+            const U32 len = 1 + ((index >> lane) & 1) + ((index >> (lane + 4)) & 1);
+            for (U32 b = 0; b < len; b++) table[index].shuffle[n++] = U8(lane * 4 + b);
+        }
+        table[index].length = n;
+        while (n < 16) table[index].shuffle[n++] = 0x80;
+    }
+    return table;
+}();
+
+/// Decode 8 positions of a block and append the code points at the positions in `keep'.
+[[LIBUTILS_TARGET_AVX2, gnu::always_inline]] inline void DecodeLanesAVX2(__m128i b0, __m128i b1, __m128i b2, U32 keep, Char*& out) {
+    const auto c0    = _mm256_cvtepu8_epi32(b0);
+    const auto c1    = _mm256_cvtepu8_epi32(b1);
+    const auto c2    = _mm256_cvtepu8_epi32(b2);
+    const auto low6  = _mm256_set1_epi32(0x3F);
+    const auto two   = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(c0, _mm256_set1_epi32(0x1F)), 6), _mm256_and_si256(c1, low6));
+    const auto three = _mm256_or_si256(
+        _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(c0, _mm256_set1_epi32(0x0F)), 12), _mm256_slli_epi32(_mm256_and_si256(c1, low6), 6)),
+        _mm256_and_si256(c2, low6)
+    );
+
+    auto cp = _mm256_blendv_epi8(c0, two, _mm256_cmpgt_epi32(c0, _mm256_set1_epi32(0xBF)));
+    cp      = _mm256_blendv_epi8(cp, three, _mm256_cmpgt_epi32(c0, _mm256_set1_epi32(0xDF)));
+    const auto order = _mm256_loadu_si256((const __m256i*) CompactLanes[keep].data());
+    _mm256_storeu_si256((__m256i*) out, _mm256_permutevar8x32_epi32(cp, order));
+    out += std::popcount(keep);
+}
+
+/**
+ * Decode the one-, two- and three-byte sequences in a block of 16 bytes
+ * <p>
+ * `in' must point to the start of a sequence, and 18 bytes must be
+ * readable. Up to 16 code points are written to `out', which may be
+ * overwritten up to 16 code points ahead.
+ * @return The number of bytes decoded, which may be less than 16 if a
+ *         sequence doesn't end in the block, or 0 if the block contains
+ *         anything else
+ */
+[[LIBUTILS_TARGET_AVX2]] U64 DecodeBlockAVX2(const U8* in, Char*& out) {
+    const auto v    = _mm_loadu_si128((const __m128i*) in);
+    const auto v1   = _mm_loadu_si128((const __m128i*) (in + 1));
+    const auto v2   = _mm_loadu_si128((const __m128i*) (in + 2));
+    const auto zero = _mm_setzero_si128();
+
+    /// As signed bytes, continuation bytes are below -64 (0xC0); lead bytes
+    /// are at least that, and those of three- and four-byte sequences are
+    /// at least -32 (0xE0) and -16 (0xF0).
+    const auto cont   = _mm_cmplt_epi8(v, _mm_set1_epi8(-64));
+    const auto lead23 = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-65)), _mm_cmplt_epi8(v, zero));
+    const auto lead3  = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-33)), _mm_cmplt_epi8(v, zero));
+    const auto lead4  = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(-17)), _mm_cmplt_epi8(v, zero));
+
+    /// A byte must be a continuation byte iff one of the two bytes before it
+    /// starts a sequence that extends to it. Since the block starts with a
+    /// sequence, nothing before it extends into it.
+    const auto expected = _mm_or_si128(_mm_slli_si128(lead23, 1), _mm_slli_si128(lead3, 2));
+
+    /// Overlong sequences start with C0, C1, or E0 followed by 80..9F, and
+    /// surrogates with ED followed by A0..BF.
+    const auto second_high = _mm_cmpeq_epi8(_mm_and_si128(v1, _mm_set1_epi8(0x20)), _mm_set1_epi8(0x20));
+    const auto overlong2   = _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xFE))), _mm_set1_epi8(char(0xC0)));
+    const auto overlong3   = _mm_andnot_si128(second_high, _mm_cmpeq_epi8(v, _mm_set1_epi8(char(0xE0))));
+    const auto surrogate   = _mm_and_si128(second_high, _mm_cmpeq_epi8(v, _mm_set1_epi8(char(0xED))));
+
+    auto bad = _mm_or_si128(_mm_xor_si128(cont, expected), lead4);
+    bad      = _mm_or_si128(bad, _mm_or_si128(overlong2, _mm_or_si128(overlong3, surrogate)));
+    if (_mm_movemask_epi8(bad)) return 0;
+
+    /// A sequence that starts in one of the last two bytes may extend past
+    /// the block; leave it for the next one.
+    U32 end = 16;
+    if (_mm_movemask_epi8(lead3) & (1 << 14)) end = 14;
+    if (_mm_movemask_epi8(lead23) & (1 << 15)) end = 15;
+
+    const U32 keep = ~U32(_mm_movemask_epi8(cont)) & ((1 << end) - 1);
+    DecodeLanesAVX2(v, v1, v2, keep & 0xFF, out);
+    DecodeLanesAVX2(_mm_srli_si128(v, 8), _mm_srli_si128(v1, 8), _mm_srli_si128(v2, 8), keep >> 8, out);
+    return end;
+}
+
+/**
+ * Encode 8 code points below U+10000
+ * <p>
+ * Up to 24 bytes are written to `out', which may be overwritten up to 32
+ * bytes ahead.
+ * @return False if any of them needs four bytes or is a surrogate
+ */
+[[LIBUTILS_TARGET_AVX2]] bool EncodeBlockAVX2(const Char* in, char*& out) {
+    const auto c         = _mm256_loadu_si256((const __m256i*) in);
+    const auto surrogate = _mm256_cmpeq_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xF800)), _mm256_set1_epi32(0xD800));
+    if (!_mm256_testz_si256(c, _mm256_set1_epi32(int(0xFFFF0000))) || !_mm256_testz_si256(surrogate, surrogate)) return false;
+
+    /// Put the encoding of each code point into the low bytes of its lane.
+    const auto low6  = _mm256_set1_epi32(0x3F);
+    const auto cont  = _mm256_set1_epi32(0x80);
+    const auto last  = _mm256_or_si256(cont, _mm256_and_si256(c, low6));
+    const auto mid   = _mm256_or_si256(cont, _mm256_and_si256(_mm256_srli_epi32(c, 6), low6));
+    const auto two   = _mm256_or_si256(_mm256_or_si256(_mm256_set1_epi32(0xC0), _mm256_srli_epi32(c, 6)), _mm256_slli_epi32(last, 8));
+    const auto three = _mm256_or_si256(
+        _mm256_or_si256(_mm256_set1_epi32(0xE0), _mm256_srli_epi32(c, 12)),
+        _mm256_or_si256(_mm256_slli_epi32(mid, 8), _mm256_slli_epi32(last, 16))
+    );
+
+    const auto ge80    = _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0x7F));
+    const auto ge800   = _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0x7FF));
+    const auto encoded = _mm256_blendv_epi8(_mm256_blendv_epi8(c, two, ge80), three, ge800);
+
+    /// Pack each half separately, since shuffles don't cross 128-bit lanes.
+    const U32   m2      = U32(_mm256_movemask_ps(_mm256_castsi256_ps(ge80)));
+    const U32   m3      = U32(_mm256_movemask_ps(_mm256_castsi256_ps(ge800)));
+    const auto& lo      = PackTable[(m2 & 0xF) | (m3 & 0xF) << 4];
+    const auto& hi      = PackTable[(m2 >> 4) | (m3 >> 4) << 4];
+    const auto  shuffle = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i*) lo.shuffle)), _mm_load_si128((const __m128i*) hi.shuffle), 1);
+    const auto  packed  = _mm256_shuffle_epi8(encoded, shuffle);
+    _mm_storeu_si128((__m128i*) out, _mm256_castsi256_si128(packed));
+    out += lo.length;
+    _mm_storeu_si128((__m128i*) out, _mm256_extracti128_si256(packed, 1));
+    out += hi.length;
+    return true;
+}
+#endif
+
+/// Shared implementation of the UTF8ToUTF32() overloads. `ret' is an empty
+/// string that determines the allocator of the result.
+template <typename TString>
+TString UTF8ToUTF32Impl(std::string_view what, UTFErrorMode mode, TString ret) {
+    const auto* in = reinterpret_cast<const U8*>(what.data());
+    const U64   n  = what.size();
+
+    /// We never produce more code points than there are bytes.
+    ret.resize(n);
+    Char* out = ret.data();
+    U64   i   = 0;
+#if LIBUTILS_X86
+    const bool avx2         = simd::HasAVX2();
+    U64        scalar_until = 0; /// Where to try the fast path again after it has failed
+#endif
+    while (i < n) {
+        const U64 ascii = WidenASCII(what.data() + i, n - i, out);
+        i += ascii;
+        out += ascii;
+
+        /// Decode multibyte sequences until we're back to ASCII. We never
+        /// produce more code points than we've consumed bytes, so the fast
+        /// path can overwrite as much as it reads.
+        while (i < n && in[i] >= 0x80) {
+#if LIBUTILS_X86
+            if (avx2 && i >= scalar_until && n - i >= 18) {
+                if (const U64 used = DecodeBlockAVX2(in + i, out)) {
+                    i += used;
+                    continue;
+                }
+                scalar_until = i + 16;
+            }
+#endif
+            Char c{};
+            I64  len = DecodeSequence(in + i, n - i, c);
+            if (len > 0) {
+                *out++ = c;
+                i += U64(len);
+                continue;
+            }
+
+            if (mode == UTFErrorMode::Throw) throw std::range_error("UTF8ToUTF32: invalid UTF-8 at offset " + std::to_string(i));
+            *out++ = ReplacementCharacter;
+            i += U64(-len);
+        }
+    }
+
+    ret.resize(U64(out - ret.data()));
+    return ret;
+}
+
+/// Shared implementation of the UTF32ToUTF8() overloads; see UTF8ToUTF32Impl().
+template <typename TString>
+TString UTF32ToUTF8Impl(std::u32string_view what, UTFErrorMode mode, TString ret) {
+    const Char* in = what.data();
+    const U64   n  = what.size();
+
+    /// Compute the size of the output up front. Invalid code points above U+10FFFF
+    /// are counted as 4 bytes but replaced with 3, so this is an upper bound.
+    const U64 size = n
+                     + simd::Count<EncodedLengthMatcher<0x80>>(in, n)
+                     + simd::Count<EncodedLengthMatcher<0x800>>(in, n)
+                     + simd::Count<EncodedLengthMatcher<0x10000>>(in, n);
+
+    ret.resize(size);
+    char* out = ret.data();
+    U64   i   = 0;
+#if LIBUTILS_X86
+    const bool  avx2         = simd::HasAVX2();
+    U64         scalar_until = 0; /// Where to try the fast path again after it has failed
+    const char* end          = out + size;
+#endif
+    while (i < n) {
+        const U64 ascii = NarrowASCII(in + i, n - i, out);
+        i += ascii;
+        out += ascii;
+
+        while (i < n && in[i] >= 0x80) {
+#if LIBUTILS_X86
+            if (avx2 && i >= scalar_until && n - i >= 8 && U64(end - out) >= 32) {
+                if (EncodeBlockAVX2(in + i, out)) {
+                    i += 8;
+                    continue;
+                }
+                scalar_until = i + 8;
+            }
+#endif
+            Char c = in[i];
+            if ((c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF) {
+                if (mode == UTFErrorMode::Throw) throw std::range_error("UTF32ToUTF8: invalid code point at offset " + std::to_string(i));
+                c = ReplacementCharacter;
+            }
+            out += EncodeSequence(c, out);
+            i++;
+        }
+    }
+
+    ret.resize(U64(out - ret.data()));
+    return ret;
+}
+} // namespace
+
+String UTF8ToUTF32(std::string_view what, UTFErrorMode mode) {
+    return UTF8ToUTF32Impl(what, mode, String{});
+}
+
+std::pmr::u32string UTF8ToUTF32(std::string_view what, std::pmr::memory_resource* resource, UTFErrorMode mode) {
+    return UTF8ToUTF32Impl(what, mode, std::pmr::u32string{resource});
+}
+
+std::string UTF32ToUTF8(std::u32string_view what, UTFErrorMode mode) {
+    return UTF32ToUTF8Impl(what, mode, std::string{});
+}
+
+std::pmr::string UTF32ToUTF8(std::u32string_view what, std::pmr::memory_resource* resource, UTFErrorMode mode) {
+    return UTF32ToUTF8Impl(what, mode, std::pmr::string{resource});
+}
+
+std::string ToLower(std::string str) { return MapCase<CaseMapping::Lower>(std::move(str)); }
+String ToLower(String str) { return MapCase<CaseMapping::Lower>(std::move(str)); }
+std::string ToUpper(std::string str) { return MapCase<CaseMapping::Upper>(std::move(str)); }
+String ToUpper(String str) { return MapCase<CaseMapping::Upper>(std::move(str)); }
+std::string CaseFold(std::string str) { return MapCase<CaseMapping::Fold>(std::move(str)); }
+String CaseFold(String str) { return MapCase<CaseMapping::Fold>(std::move(str)); }
+
+Char ToLowerChar(Char c) { return MapCase<CaseMapping::Lower>(c); }
+Char ToUpperChar(Char c) { return MapCase<CaseMapping::Upper>(c); }
+Char CaseFoldChar(Char c) { return MapCase<CaseMapping::Fold>(c); }
+
+bool EqualsIgnoreCase(std::u32string_view a, std::u32string_view b) {
+    /// Simple case folding never changes the length of a string.
+    if (a.size() != b.size()) return false;
+    for (U64 i = 0; i < a.size(); i++)
+        if (a[i] != b[i] && MapCase<CaseMapping::Fold>(a[i]) != MapCase<CaseMapping::Fold>(b[i])) return false;
+    return true;
+}
+
+bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (U64 i = 0; i < a.size(); i++)
+        if (a[i] != b[i] && (U8(a[i]) >= 0x80 || U8(b[i]) >= 0x80 || MapCase<CaseMapping::Fold>(Char(a[i])) != MapCase<CaseMapping::Fold>(Char(b[i])))) return false;
+    return true;
+}
+
+UTF8ValidationResult ValidateUTF8(std::string_view what) {
+    const auto* in = reinterpret_cast<const U8*>(what.data());
+    const U64   n  = what.size();
+    U64         error_offset;
+#if LIBUTILS_X86
+    if (simd::HasAVX2()) error_offset = ValidateUTF8AVX2(in, n);
+    else if (simd::HasSSSE3()) error_offset = ValidateUTF8SSSE3(in, n);
+    else
+#endif
+        error_offset = ValidateUTF8Scalar(in, 0, n);
+    return {error_offset == n, error_offset};
+}
+
+LIBUTILS_NAMESPACE_END
@@ -1,7 +1,9 @@
 #include "../include/utils.h"
 
-#include <codecvt>
+#include "./simd.h"
+
 #include <cstdarg>
+#include <cstring>
 #include <locale>
 
 LIBUTILS_NAMESPACE_BEGIN
@@ -22,66 +24,355 @@ void Die(const char* format, ...) {
     exit(1);
 }
 
-String Escape(const String& str) {
-    String ret;
-    for (auto c : str) {
-        switch (c) {
-            case U'\n': ret += U"\\n"; continue;
-            case U'\r': ret += U"\\r"; continue;
-            case U'\t': ret += U"\\t"; continue;
-            case U'\v': ret += U"\\v"; continue;
-            case U'\f': ret += U"\\f"; continue;
-            case U'\'': ret += U"\\\'"; continue;
-            case U'\"': ret += U"\\\""; continue;
-            default: ret += c;
-        }
+namespace {
+/// Matches the characters that Escape() replaces with an escape sequence.
+struct EscapeMatcher {
+    template <typename T>
+    static bool Scalar(T c) { return (c >= 9 && c <= 13) || c == '\'' || c == '"'; }
+
+#if LIBUTILS_SSE2
+    template <typename T>
+    static __m128i Block(__m128i v) {
+        return _mm_or_si128(simd::InRange<T>(v, 9, 13), _mm_or_si128(simd::Eq<T>(v, '\''), simd::Eq<T>(v, '"')));
+    }
+#endif
+
+#if LIBUTILS_X86
+    template <typename T>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] static __m256i Block(__m256i v) {
+        return _mm256_or_si256(simd::InRange<T>(v, 9, 13), _mm256_or_si256(simd::Eq<T>(v, '\''), simd::Eq<T>(v, '"')));
+    }
+#endif
+};
+
+/// Matches the backslash that starts an escape sequence.
+struct BackslashMatcher {
+    template <typename T>
+    static bool Scalar(T c) { return c == '\\'; }
+
+#if LIBUTILS_SSE2
+    template <typename T>
+    static __m128i Block(__m128i v) { return simd::Eq<T>(v, '\\'); }
+#endif
+
+#if LIBUTILS_X86
+    template <typename T>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] static __m256i Block(__m256i v) { return simd::Eq<T>(v, '\\'); }
+#endif
+};
+
+/// The character that follows the backslash in the escape sequence for `c'.
+template <typename T>
+T EscapeLetter(T c) {
+    switch (c) {
+        case '\n': return T('n');
+        case '\r': return T('r');
+        case '\t': return T('t');
+        case '\v': return T('v');
+        case '\f': return T('f');
+        default: return c; /// ' and "
     }
-    return ret;
 }
 
-std::string Escape(const std::string& str) {
-    std::string ret;
-    for (auto c : str) {
-        switch (c) {
-            case '\n': ret += "\\n"; continue;
-            case '\r': ret += "\\r"; continue;
-            case '\t': ret += "\\t"; continue;
-            case '\v': ret += "\\v"; continue;
-            case '\f': ret += "\\f"; continue;
-            case '\'': ret += "\\\'"; continue;
-            case '\"': ret += "\\\""; continue;
-            default: ret += c;
-        }
+/// Shared implementation of the Escape() overloads.
+///
+/// Count the characters that need escaping first so that we can size the
+/// output exactly; after that, copy the runs between two such characters
+/// in bulk instead of appending one character at a time. `ret' is an
+/// empty string that determines the allocator of the result.
+template <typename TString>
+TString EscapeImpl(std::basic_string_view<typename TString::value_type> str, TString ret) {
+    using T             = typename TString::value_type;
+    const T*  data      = str.data();
+    const U64 size      = str.size();
+    const U64 n_escapes = simd::Count<EscapeMatcher>(data, size);
+
+    /// Nothing to escape, so don't bother scanning the string again.
+    if (!n_escapes) {
+        ret.assign(data, size);
+        return ret;
+    }
+
+    ret.resize(size + n_escapes);
+    T*  out = ret.data();
+    U64 pos = 0;
+    for (;;) {
+        const U64 next = pos + simd::FindFirst<EscapeMatcher>(data + pos, size - pos);
+        std::char_traits<T>::copy(out, data + pos, next - pos);
+        out += next - pos;
+        if (next == size) break;
+        *out++ = T('\\');
+        *out++ = EscapeLetter(data[next]);
+        pos    = next + 1;
     }
     return ret;
 }
 
-std::string Unescape(const std::string& str) {
-    std::string ret;
-    for (U64 i = 0; i < str.size(); i++) {
-        switch (str[i]) {
-            case '\\': {
-                i++;
-                if (i == str.size()) return ret;
-                switch (str[i]) {
-                    case 'n': ret += '\n'; continue;
-                    case 'r': ret += '\r'; continue;
-                    case 't': ret += '\t'; continue;
-                    case 'v': ret += '\v'; continue;
-                    case 'f': ret += '\f'; continue;
-                    case '\'': ret += '\''; continue;
-                    case '\"': ret += '\"'; continue;
-                    case '\\': ret += '\\'; continue;
-                    default:
-                        ret += '\\';
-                        ret += str[i];
-                        continue;
-                }
-            } break;
-            default: ret += str[i];
+/// Shared implementation of the Unescape() overloads; see EscapeImpl().
+template <typename TString>
+TString UnescapeImpl(std::string_view str, TString ret) {
+    /// Unescaping never makes a string longer.
+    const char* data = str.data();
+    const U64   size = str.size();
+    ret.resize(size);
+    char* out = ret.data();
+    U64   pos = 0;
+    for (;;) {
+        const U64 next = pos + simd::FindFirst<BackslashMatcher>(data + pos, size - pos);
+        std::char_traits<char>::copy(out, data + pos, next - pos);
+        out += next - pos;
+
+        /// A backslash at the very end of the string is dropped.
+        if (next + 1 >= size) break;
+        switch (const char c = data[next + 1]) {
+            case 'n': *out++ = '\n'; break;
+            case 'r': *out++ = '\r'; break;
+            case 't': *out++ = '\t'; break;
+            case 'v': *out++ = '\v'; break;
+            case 'f': *out++ = '\f'; break;
+            case '\'':
+            case '\"':
+            case '\\': *out++ = c; break;
+            default:
+                *out++ = '\\';
+                *out++ = c;
+                break;
         }
+        pos = next + 2;
     }
+    ret.resize(U64(out - ret.data()));
     return ret;
 }
+} // namespace
+
+namespace {
+/*
+ * Substring search for short needles.
+ *
+ * Compare the first and last character of the needle against a block of
+ * positions in the haystack at once; only positions where both match need
+ * to be verified. This rarely produces false positives in practice.
+ */
+template <typename T>
+bool MatchesAt(const T* haystack, const T* needle, U64 m) {
+    return m < 3 || std::char_traits<T>::compare(haystack + 1, needle + 1, m - 2) == 0;
+}
+
+template <typename T>
+U64 FindShortScalar(const T* haystack, U64 n, const T* needle, U64 m, U64 i) {
+    for (; i + m <= n; i++)
+        if (haystack[i] == needle[0] && haystack[i + m - 1] == needle[m - 1] && MatchesAt(haystack + i, needle, m))
+            return i;
+    return U64(-1);
+}
+
+/// Iterate over the set bits in a movemask result and verify each candidate.
+template <typename T>
+U64 VerifyCandidates(U32 mask, const T* haystack, U64 i, const T* needle, U64 m) {
+    while (mask) {
+        const U64 lane = U64(std::countr_zero(mask)) / sizeof(T);
+        if (MatchesAt(haystack + i + lane, needle, m)) return i + lane;
+        mask &= ~(((1u << sizeof(T)) - 1) << (lane * sizeof(T)));
+    }
+    return U64(-1);
+}
+
+#if LIBUTILS_SSE2
+template <typename T>
+U64 FindShortSSE2(const T* haystack, U64 n, const T* needle, U64 m) {
+    constexpr U64 lanes = 16 / sizeof(T);
+    U64           i     = 0;
+    for (; i + m - 1 + lanes <= n; i += lanes) {
+        auto first = _mm_loadu_si128((const __m128i*) (haystack + i));
+        auto last  = _mm_loadu_si128((const __m128i*) (haystack + i + m - 1));
+        auto eq    = _mm_and_si128(simd::Eq<T>(first, needle[0]), simd::Eq<T>(last, needle[m - 1]));
+        if (U64 pos = VerifyCandidates(U32(_mm_movemask_epi8(eq)), haystack, i, needle, m); pos != U64(-1))
+            return pos;
+    }
+    return FindShortScalar(haystack, n, needle, m, i);
+}
+#endif
+
+#if LIBUTILS_X86
+template <typename T>
+[[LIBUTILS_TARGET_AVX2]] U64 FindShortAVX2(const T* haystack, U64 n, const T* needle, U64 m) {
+    constexpr U64 lanes = 32 / sizeof(T);
+    U64           i     = 0;
+    for (; i + m - 1 + lanes <= n; i += lanes) {
+        auto first = _mm256_loadu_si256((const __m256i*) (haystack + i));
+        auto last  = _mm256_loadu_si256((const __m256i*) (haystack + i + m - 1));
+        auto eq    = _mm256_and_si256(simd::Eq<T>(first, needle[0]), simd::Eq<T>(last, needle[m - 1]));
+        if (U64 pos = VerifyCandidates(U32(_mm256_movemask_epi8(eq)), haystack, i, needle, m); pos != U64(-1))
+            return pos;
+    }
+    return FindShortScalar(haystack, n, needle, m, i);
+}
+#endif
+
+template <typename T>
+U64 FindShort(const T* haystack, U64 n, const T* needle, U64 m) {
+#if LIBUTILS_X86
+    if (simd::HasAVX2()) return FindShortAVX2(haystack, n, needle, m);
+#endif
+#if LIBUTILS_SSE2
+    return FindShortSSE2(haystack, n, needle, m);
+#else
+    return FindShortScalar(haystack, n, needle, m, 0);
+#endif
+}
+} // namespace
+
+U64 _libutils_find_short(const char* haystack, U64 n, const char* needle, U64 m) {
+    return FindShort(haystack, n, needle, m);
+}
+
+U64 _libutils_find_short(const Char* haystack, U64 n, const Char* needle, U64 m) {
+    return FindShort(haystack, n, needle, m);
+}
+
+namespace {
+/// Matches a single character.
+template <typename T>
+struct CharMatcher {
+    T c;
+
+    bool Scalar(T x) const { return x == c; }
+
+#if LIBUTILS_SSE2
+    template <typename>
+    __m128i Block(__m128i v) const { return simd::Eq<T>(v, c); }
+#endif
+
+#if LIBUTILS_X86
+    template <typename>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] __m256i Block(__m256i v) const { return simd::Eq<T>(v, c); }
+#endif
+};
+
+/// Matches ASCII whitespace as well as every character that might be
+/// Unicode whitespace; the latter need to be checked separately.
+struct SpaceMatcher {
+    template <typename T>
+    static bool Scalar(T c) { return _libutils_is_space(c); }
+
+#if LIBUTILS_SSE2
+    template <typename T>
+    static __m128i Block(__m128i v) {
+        auto ascii = _mm_or_si128(simd::InRange<T>(v, 9, 13), simd::Eq<T>(v, ' '));
+        if constexpr (sizeof(T) == 1) return ascii;
+        else return _mm_or_si128(ascii, _mm_andnot_si128(simd::InRange<T>(v, 0, 0x84), _mm_set1_epi32(-1)));
+    }
+#endif
+
+#if LIBUTILS_X86
+    template <typename T>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] static __m256i Block(__m256i v) {
+        auto ascii = _mm256_or_si256(simd::InRange<T>(v, 9, 13), simd::Eq<T>(v, ' '));
+        if constexpr (sizeof(T) == 1) return ascii;
+        else return _mm256_or_si256(ascii, _mm256_andnot_si256(simd::InRange<T>(v, 0, 0x84), _mm256_set1_epi32(-1)));
+    }
+#endif
+};
+
+/// Matches everything except ASCII whitespace; characters that are not ASCII
+/// may still be Unicode whitespace and need to be checked separately.
+struct NonSpaceMatcher {
+    template <typename T>
+    static bool Scalar(T c) { return !_libutils_is_space(c); }
+
+#if LIBUTILS_SSE2
+    template <typename T>
+    static __m128i Block(__m128i v) {
+        auto ascii = _mm_or_si128(simd::InRange<T>(v, 9, 13), simd::Eq<T>(v, ' '));
+        return _mm_andnot_si128(ascii, _mm_set1_epi32(-1));
+    }
+#endif
+
+#if LIBUTILS_X86
+    template <typename T>
+    [[LIBUTILS_TARGET_AVX2, gnu::always_inline]] static __m256i Block(__m256i v) {
+        auto ascii = _mm256_or_si256(simd::InRange<T>(v, 9, 13), simd::Eq<T>(v, ' '));
+        return _mm256_andnot_si256(ascii, _mm256_set1_epi32(-1));
+    }
+#endif
+};
+
+/// Find the first character that satisfies `Matcher' and passes the exact check.
+template <typename Matcher, typename T, typename Check>
+U64 FindVerified(const T* data, U64 n, Check check) {
+    U64 i = 0;
+    for (;;) {
+        i += simd::FindFirst<Matcher>(data + i, n - i);
+        if (i == n || check(data[i])) return i;
+        i++;
+    }
+}
+} // namespace
+
+bool _libutils_is_space(Char c) {
+    if (c < 0x80) return (c >= 9 && c <= 13) || c == ' ';
+    switch (c) {
+        case 0x85:
+        case 0xA0:
+        case 0x1680:
+        case 0x2000 ... 0x200A:
+        case 0x2028:
+        case 0x2029:
+        case 0x202F:
+        case 0x205F:
+        case 0x3000: return true;
+        default: return false;
+    }
+}
+
+U64 _libutils_find_char(const char* data, U64 n, char c) {
+    /// memchr() is already vectorised.
+    const void* pos = std::memchr(data, c, n);
+    return pos ? U64(static_cast<const char*>(pos) - data) : n;
+}
+
+U64 _libutils_find_char(const Char* data, U64 n, Char c) {
+    return simd::FindFirst(data, n, CharMatcher<Char>{c});
+}
+
+U64 _libutils_find_space(const char* data, U64 n) {
+    return simd::FindFirst<SpaceMatcher>(data, n);
+}
+
+U64 _libutils_find_space(const Char* data, U64 n) {
+    return FindVerified<SpaceMatcher>(data, n, [](Char c) { return _libutils_is_space(c); });
+}
+
+U64 _libutils_find_non_space(const char* data, U64 n) {
+    return simd::FindFirst<NonSpaceMatcher>(data, n);
+}
+
+U64 _libutils_find_non_space(const Char* data, U64 n) {
+    return FindVerified<NonSpaceMatcher>(data, n, [](Char c) { return !_libutils_is_space(c); });
+}
+
+String Escape(const String& str) {
+    return EscapeImpl(std::u32string_view{str}, String{});
+}
+
+std::string Escape(const std::string& str) {
+    return EscapeImpl(std::string_view{str}, std::string{});
+}
+
+std::pmr::u32string Escape(std::u32string_view str, std::pmr::memory_resource* resource) {
+    return EscapeImpl(str, std::pmr::u32string{resource});
+}
+
+std::pmr::string Escape(std::string_view str, std::pmr::memory_resource* resource) {
+    return EscapeImpl(str, std::pmr::string{resource});
+}
+
+std::string Unescape(const std::string& str) {
+    return UnescapeImpl(std::string_view{str}, std::string{});
+}
+
+std::pmr::string Unescape(std::string_view str, std::pmr::memory_resource* resource) {
+    return UnescapeImpl(str, std::pmr::string{resource});
+}
 
 LIBUTILS_NAMESPACE_END
@@ -0,0 +1,62 @@
+#include "../include/arena.h"
+#include "./test.h"
+
+namespace {
+/// An upstream resource that keeps track of how much memory is outstanding.
+struct CountingResource : std::pmr::memory_resource {
+    U64 bytes{};
+    U64 chunks{};
+
+    void* do_allocate(std::size_t size, std::size_t align) override {
+        bytes += size;
+        chunks++;
+        return std::pmr::new_delete_resource()->allocate(size, align);
+    }
+
+    void do_deallocate(void* p, std::size_t size, std::size_t align) override {
+        bytes -= size;
+        chunks--;
+        std::pmr::new_delete_resource()->deallocate(p, size, align);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+} // namespace
+
+int main() {
+    static constexpr U64 ChunkSize = 4096;
+    CountingResource     upstream;
+    {
+        Arena arena{ChunkSize, &upstream};
+        void* first = arena.Allocate(16);
+        arena.Allocate(1 << 20);
+        CHECK(upstream.chunks == 2);
+        CHECK(arena.BytesUsed() == 16 + (1 << 20));
+
+        /// Only the first chunk is kept, and we keep allocating from it.
+        arena.Reset();
+        CHECK(upstream.chunks == 1);
+        CHECK(upstream.bytes == ChunkSize);
+        CHECK(arena.BytesUsed() == 0);
+        CHECK(arena.Allocate(16) == first);
+
+        /// A large allocation before any other allocation doesn't become the first chunk.
+        arena.Release();
+        CHECK(upstream.chunks == 0);
+        arena.Allocate(1 << 20);
+        first = arena.Allocate(16);
+        arena.Reset();
+        CHECK(upstream.bytes == ChunkSize);
+        CHECK(arena.Allocate(16) == first);
+
+        /// Fill several regular chunks; Reset() keeps the oldest one.
+        for (int i = 0; i < 100; i++) arena.Allocate(1000);
+        CHECK(upstream.chunks > 1);
+        arena.Reset();
+        CHECK(upstream.bytes == ChunkSize);
+        CHECK(arena.Allocate(16) == first);
+    }
+    CHECK(upstream.chunks == 0);
+    CHECK(upstream.bytes == 0);
+    return test::failures != 0;
+}
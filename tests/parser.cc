@@ -0,0 +1,76 @@
+#include "../include/interner.h"
+#include "../include/parser.h"
+#include "./test.h"
+
+#include <vector>
+
+namespace {
+using SourceFile     = FileBase<>;
+using SourceLocation = SourceLocationBase<SourceFile>;
+
+struct Token : TokenBase<Char, TokenTypeBase, SourceLocation> {
+    [[nodiscard]] String Str() const override { return string_content; }
+};
+
+struct Lexer : LexerBase<SourceFile, Token, SourceLocation> {
+    Lexer(const std::string& filename, Interner<Char>* _interner) : LexerBase(filename) {
+        interner = _interner;
+        NextToken();
+    }
+
+    void NextToken() override {
+        SkipWhitespace();
+        token.loc = Here();
+        if (at_eof) {
+            token.type = T::EndOfFile;
+            return;
+        }
+
+        if (isstart(int(lastc)) || lastc == U'_') return LexIdentifier();
+        if (lastc >= U'0' && lastc <= U'9') {
+            token.type = T::Number;
+            token.string_content.clear();
+            LexNumber();
+            return;
+        }
+
+        token.type = T::String;
+        token.string_content.clear();
+        LexStringLiteral();
+    }
+};
+
+/// Lex a source string and return all of its tokens.
+std::vector<Token> Lex(const std::string& src, Interner<Char>& interner) {
+    std::string path = "/tmp/utils_test_parser_XXXXXX";
+    const int   fd   = mkstemp(path.data());
+    if (fd < 0 || write(fd, src.data(), src.size()) != I64(src.size())) Die("Could not write '%s'", path.c_str());
+    close(fd);
+
+    std::vector<Token> tokens;
+    Lexer              lexer{path, &interner};
+    for (; lexer.token.type != TokenTypeBase::EndOfFile; lexer.NextToken()) tokens.push_back(lexer.token);
+    unlink(path.c_str());
+    return tokens;
+}
+} // namespace
+
+int main() {
+    Interner<Char> interner;
+    const auto     tokens = Lex("foo \"a\" \"b\" foo bar \"a\" 1", interner);
+    CHECK(tokens.size() == 7);
+    if (tokens.size() != 7) return 1;
+
+    CHECK(tokens[0] == tokens[3]);
+    CHECK(!(tokens[0] == tokens[4]));
+    CHECK(tokens[1].symbol == NoSymbol);
+    CHECK(tokens[6].symbol == NoSymbol);
+    CHECK(!(tokens[1] == tokens[2]));
+    CHECK(tokens[1] == tokens[5]);
+
+    /// A stale symbol must not make other tokens compare equal.
+    Token a = tokens[1], b = tokens[2];
+    a.symbol = b.symbol = tokens[0].symbol;
+    CHECK(!(a == b));
+    return test::failures != 0;
+}
@@ -0,0 +1,32 @@
+#include "./test.h"
+
+#include <string>
+
+namespace {
+/// Search for short and long needles with a character type that has no SIMD filter.
+template <typename TString>
+void TestSearcher(const TString& a, const TString& b, const TString& x) {
+    using TChar = typename TString::value_type;
+    CHECK(Searcher<TChar>{a}.Find(x + x + a) == 2);
+    CHECK(Searcher<TChar>{a + b}.Find(a + a + b + a) == 1);
+    CHECK(Searcher<TChar>{a + b}.Find(a + a + a) == Searcher<TChar>::npos);
+    CHECK(Searcher<TChar>{a + b}.Find(a + b + a + b, 1) == 2);
+
+    TString long_needle;
+    for (int i = 0; i < 40; i++) long_needle += i % 3 ? a : b;
+    CHECK(Searcher<TChar>{long_needle}.Find(x + long_needle + x) == 1);
+    CHECK(Searcher<TChar>{long_needle}.Find(long_needle.substr(1)) == Searcher<TChar>::npos);
+
+    TString str = x + a + b + x + a + b;
+    ReplaceAll(str, a + b, x);
+    CHECK(str == x + x + x + x);
+}
+} // namespace
+
+int main() {
+    TestSearcher<std::string>("a", "b", "x");
+    TestSearcher<std::wstring>(L"a", L"b", L"x");
+    TestSearcher<std::u16string>(u"a", u"b", u"x");
+    TestSearcher<std::u32string>(U"a", U"b", U"x");
+    return test::failures != 0;
+}
@@ -0,0 +1,26 @@
+#ifndef UTILS_TEST_H
+#define UTILS_TEST_H
+
+#include "../include/utils.h"
+
+#include <cstdio>
+
+LIBUTILS_NAMESPACE_BEGIN
+namespace test {
+
+/// Number of checks that have failed so far.
+inline int failures = 0;
+
+/** Report a failed check; use CHECK() instead */
+inline void Fail(const char* expr, const char* file, int line) {
+    std::fprintf(stderr, "%s:%d: check failed: %s\n", file, line, expr);
+    failures++;
+}
+
+} // namespace test
+LIBUTILS_NAMESPACE_END
+
+/// Check a condition and keep going if it doesn't hold.
+#define CHECK(...) ((__VA_ARGS__) ? void() : test::Fail(#__VA_ARGS__, __FILE__, __LINE__))
+
+#endif // UTILS_TEST_H